@@ -1,4 +1,24 @@
 #!/bin/bash
 
-#gcc -shared -fPIC `pkg-config --cflags --libs exo-1 thunarx-2` -DG_ENABLE_DEBUG -o thunar-nextcloud-plugin.so thunar-nextcloud-plugin.c tnp-provider.c
-gcc -shared -fPIC `pkg-config --cflags --libs exo-2 thunarx-3` -o thunar-nextcloud-plugin.so thunar-nextcloud-plugin.c tnp-provider.c
+# headless core (socket client, framer, protocol, sync roots and caches), see tnp-core.h
+CORE="tnp-path-index.c tnp-path-arena.c tnp-path-cache.c tnp-status.c tnp-framer.c tnp-queue.c tnp-client.c tnp-stats.c tnp-protocol.c tnp-menu.c tnp-root-snapshot.c tnp-trace.c tnp-writer.c tnp-rtt.c"
+#gcc -c -fPIC `pkg-config --cflags gio-2.0` -DG_ENABLE_DEBUG $CORE
+gcc -c -fPIC -O2 `pkg-config --cflags gio-2.0` $CORE
+ar rcs libtnp-core.a ${CORE//.c/.o}
+rm -f ${CORE//.c/.o}
+
+# the Thunar glue, linking the core
+#gcc -shared -fPIC `pkg-config --cflags exo-1 thunarx-2` -DG_ENABLE_DEBUG -o thunar-nextcloud-plugin.so thunar-nextcloud-plugin.c tnp-provider.c libtnp-core.a `pkg-config --libs exo-1 thunarx-2`
+gcc -shared -fPIC `pkg-config --cflags exo-2 thunarx-3` -o thunar-nextcloud-plugin.so thunar-nextcloud-plugin.c tnp-provider.c libtnp-core.a `pkg-config --libs exo-2 thunarx-3`
+
+# benchmark against a mock Nextcloud client, run ./tnp-bench --help for options
+gcc `pkg-config --cflags gio-2.0` -O2 -o tnp-bench tnp-bench.c libtnp-core.a `pkg-config --libs gio-2.0`
+
+# the hot paths of the core in isolation, run ./tnp-microbench --help for options
+gcc `pkg-config --cflags gio-2.0` -O2 -o tnp-microbench tnp-microbench.c libtnp-core.a `pkg-config --libs gio-2.0`
+
+# unit tests of the core, run ./tnp-test
+gcc `pkg-config --cflags gio-2.0` -O2 -o tnp-test tnp-test.c libtnp-core.a `pkg-config --libs gio-2.0`
+
+# replay of a socket trace recorded with TNP_TRACE=<file>, run ./tnp-replay --help for options
+gcc `pkg-config --cflags gio-2.0` -O2 -o tnp-replay tnp-replay.c libtnp-core.a `pkg-config --libs gio-2.0`
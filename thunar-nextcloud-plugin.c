@@ -20,6 +20,8 @@
 
 #include <exo/exo.h>
 #include "tnp-provider.h"
+#include "tnp-stats.h"
+#include "tnp-trace.h"
 
 G_MODULE_EXPORT void thunar_extension_initialize(ThunarxProviderPlugin* plugin);
 G_MODULE_EXPORT void thunar_extension_shutdown();
@@ -30,6 +32,7 @@ static GType type_list[1];
 void thunar_extension_initialize(ThunarxProviderPlugin* plugin)
 {
     const gchar* mismatch;
+    gint64 start;
 
     /* verify that the thunarx versions are compatible */
     mismatch = thunarx_check_version (THUNARX_MAJOR_VERSION, THUNARX_MINOR_VERSION, THUNARX_MICRO_VERSION);
@@ -43,11 +46,18 @@ void thunar_extension_initialize(ThunarxProviderPlugin* plugin)
     g_message ("Initializing thunar-nextcloud-plugin extension");
     #endif
 
+    /* collect statistics if requested through TNP_STATS */
+    tnp_stats_init();
+    start = tnp_stats_start();
+    /* capture the socket traffic if requested through TNP_TRACE */
+    tnp_trace_init();
+
     /* register the types provided by this plugin */
     tnp_provider_register_type(plugin);
 
     /* setup the plugin provider type list */
     type_list[0] = TNP_TYPE_PROVIDER;
+    tnp_stats_record(TNP_STATS_STARTUP, start);
 }
 
 void thunar_extension_shutdown()
@@ -55,6 +65,13 @@ void thunar_extension_shutdown()
     #ifdef G_ENABLE_DEBUG
     g_message ("Shutting down thunar-nextcloud-plugin extension");
     #endif
+
+    /* close the connections once the last provider is gone */
+    tnp_provider_shutdown();
+
+    /* write the final statistics */
+    tnp_stats_shutdown();
+    tnp_trace_shutdown();
 }
 
 void thunar_extension_list_types (const GType** types, gint* n_types)
@@ -0,0 +1,583 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Benchmark for the hot paths of the plugin. Runs without Thunar against a
+ * mock Nextcloud client that listens on a socket below a temporary
+ * XDG_RUNTIME_DIR and answers REGISTER_PATH/SHARE:/STATUS: like the real one.
+ *
+ *   connect  connecting and receiving all sync roots
+ *   share    round trip of a single SHARE: request
+ *   burst    SHARE: requests queued one by one without waiting for replies,
+ *            as written to the socket in batches
+ *   flood    receiving and handling a burst of STATUS: messages
+ *   menu     resolving a selection and querying its status, as done when
+ *            the file menu is built
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#include "tnp-client.h"
+#include "tnp-path-arena.h"
+#include "tnp-path-cache.h"
+#include "tnp-stats.h"
+#include "tnp-status.h"
+#include "tnp-trace.h"
+
+// give up if the mock client does not answer in time (milliseconds)
+#define WAIT_TIMEOUT 10000
+
+typedef struct
+{
+    TnpClient*      client;
+    TnpPathArena*   arena;
+    TnpStatusCache* status_cache;
+    guint           roots;
+    guint           share_replies;
+    guint           status_messages;
+    guint           floods_done;
+} BenchState;
+
+// settings, see "options" below
+static gint n_roots = 16;
+static gint n_connects = 20;
+static gint n_shares = 2000;
+static gint n_flood = 100000;
+static gint n_files = 10000;
+static gint latency = 0;
+
+static gchar** sync_roots = NULL;
+static int server_socket = -1;
+// value of the "writes" counter at the end of the previous stage
+static guint64 last_writes = 0;
+
+static GOptionEntry options[] =
+{
+    { "roots", 'r', 0, G_OPTION_ARG_INT, &n_roots, "Number of sync roots registered by the mock client", "N" },
+    { "connects", 'c', 0, G_OPTION_ARG_INT, &n_connects, "Number of connections to measure", "N" },
+    { "shares", 's', 0, G_OPTION_ARG_INT, &n_shares, "Number of SHARE: round trips to measure", "N" },
+    { "flood", 'f', 0, G_OPTION_ARG_INT, &n_flood, "Number of STATUS: messages in the flood", "N" },
+    { "files", 'm', 0, G_OPTION_ARG_INT, &n_files, "Number of files to build the menu for", "N" },
+    { "latency", 'l', 0, G_OPTION_ARG_INT, &latency, "Delay of the mock client before each reply", "USEC" },
+    { NULL }
+};
+
+static gint64 now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static gint compare_samples(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64*)a;
+    gint64 y = *(const gint64*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Prints the percentiles of the "samples" (in nanoseconds) and the rate of
+ * "messages" handled in "total" nanoseconds. With TNP_STATS set, the writes
+ * to the socket since the previous stage are shown as well.
+ */
+static void report(const gchar* name, GArray* samples, guint messages, gint64 total)
+{
+    gdouble p50, p99;
+
+    printf("%-8s n=%-7u", name, messages);
+    if(samples != NULL && samples->len > 0)
+    {
+        g_array_sort(samples, compare_samples);
+        p50 = g_array_index(samples, gint64, samples->len / 2) / 1000.0;
+        p99 = g_array_index(samples, gint64, MIN(samples->len - 1, samples->len * 99 / 100)) / 1000.0;
+        printf(" p50=%9.1fus p99=%9.1fus", p50, p99);
+    }
+    else
+    {
+        printf(" %-30s", "");
+    }
+    printf(" %12.0f msg/s", total > 0 ? messages * 1e9 / total : 0.0);
+    if(tnp_stats_enabled)
+    {
+        printf(" %8" G_GUINT64_FORMAT " writes", tnp_stats_get(TNP_STATS_WRITES) - last_writes);
+        last_writes = tnp_stats_get(TNP_STATS_WRITES);
+    }
+    printf("\n");
+}
+
+static gboolean wait_timeout(gpointer user_data)
+{
+    *(gboolean*)user_data = TRUE;
+    return FALSE;
+}
+
+/**
+ * Runs the main loop until "*flag" reaches "target". The loop blocks instead
+ * of spinning so the mock client is not starved of CPU time.
+ * @return FALSE on timeout
+ */
+static gboolean wait_for(const guint* flag, guint target)
+{
+    gboolean timed_out = FALSE;
+    guint timeout_id;
+
+    if(*flag >= target)
+    {
+        return TRUE;
+    }
+    timeout_id = g_timeout_add(WAIT_TIMEOUT, wait_timeout, &timed_out);
+    while(*flag < target && !timed_out)
+    {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    if(timed_out)
+    {
+        g_printerr("Timed out waiting for the mock client\n");
+        return FALSE;
+    }
+    g_source_remove(timeout_id);
+    return TRUE;
+}
+
+/* mock client */
+
+static gboolean server_write(int fd, const gchar* data, gsize length)
+{
+    ssize_t ret;
+
+    while(length > 0)
+    {
+        ret = send(fd, data, length, MSG_NOSIGNAL);
+        if(ret < 0)
+        {
+            return FALSE;
+        }
+        data += ret;
+        length -= ret;
+    }
+    return TRUE;
+}
+
+/**
+ * Answers a single command. "FLOOD:<n>" is understood by the mock only.
+ */
+static gboolean server_handle_line(int fd, const gchar* line, GString* reply)
+{
+    gint i, n;
+
+    g_string_truncate(reply, 0);
+    if(latency > 0)
+    {
+        g_usleep(latency);
+    }
+    if(strncmp(line, "SHARE:", strlen("SHARE:")) == 0)
+    {
+        g_string_append_printf(reply, "SHARE:OK:%s\n", line + strlen("SHARE:"));
+    }
+    else if(strncmp(line, "RETRIEVE_FILE_STATUS:", strlen("RETRIEVE_FILE_STATUS:")) == 0)
+    {
+        g_string_append_printf(reply, "STATUS:OK:%s\n", line + strlen("RETRIEVE_FILE_STATUS:"));
+    }
+    else if(strncmp(line, "RETRIEVE_FOLDER_STATUS:", strlen("RETRIEVE_FOLDER_STATUS:")) == 0)
+    {
+        g_string_append_printf(reply, "STATUS:OK+SWM:%s\n", line + strlen("RETRIEVE_FOLDER_STATUS:"));
+    }
+    else if(strncmp(line, "FLOOD:", strlen("FLOOD:")) == 0)
+    {
+        n = atoi(line + strlen("FLOOD:"));
+        for(i = 0; i < n; i++)
+        {
+            g_string_append_printf(reply, "STATUS:SYNC:%s/dir/file%d\n", sync_roots[i % n_roots], i);
+            // keep the buffer small, the flood is about the reading side
+            if(reply->len > 65536)
+            {
+                if(!server_write(fd, reply->str, reply->len))
+                {
+                    return FALSE;
+                }
+                g_string_truncate(reply, 0);
+            }
+        }
+        g_string_append_printf(reply, "UPDATE_VIEW:%s\n", sync_roots[0]);
+    }
+    return server_write(fd, reply->str, reply->len);
+}
+
+static void server_handle_connection(int fd)
+{
+    GString* input = g_string_new(NULL);
+    GString* reply = g_string_new(NULL);
+    gchar buffer[4096];
+    gchar* newline;
+    gsize start;
+    ssize_t ret;
+    gint i;
+
+    for(i = 0; i < n_roots; i++)
+    {
+        g_string_append_printf(reply, "REGISTER_PATH:%s\n", sync_roots[i]);
+    }
+    if(!server_write(fd, reply->str, reply->len))
+    {
+        goto out;
+    }
+    while((ret = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+    {
+        g_string_append_len(input, buffer, ret);
+        start = 0;
+        while((newline = memchr(input->str + start, '\n', input->len - start)) != NULL)
+        {
+            *newline = '\0';
+            if(!server_handle_line(fd, input->str + start, reply))
+            {
+                goto out;
+            }
+            start = newline - input->str + 1;
+        }
+        g_string_erase(input, 0, start);
+    }
+out:
+    close(fd);
+    g_string_free(input, TRUE);
+    g_string_free(reply, TRUE);
+}
+
+static gpointer server_thread(gpointer user_data)
+{
+    int fd;
+
+    // the listening socket is shut down when the benchmark is done
+    while((fd = accept(server_socket, NULL, NULL)) >= 0)
+    {
+        server_handle_connection(fd);
+    }
+    return NULL;
+}
+
+static gboolean server_start(const gchar* socket_path)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(g_strlcpy(addr.sun_path, socket_path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path))
+    {
+        return FALSE;
+    }
+    server_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(server_socket < 0 || bind(server_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+       listen(server_socket, 4) != 0)
+    {
+        return FALSE;
+    }
+    g_thread_unref(g_thread_new("mock-client", server_thread, NULL));
+    return TRUE;
+}
+
+/* plugin side */
+
+static void handle_share(const TnpMessage* message, gpointer user_data)
+{
+    BenchState* state = user_data;
+    state->share_replies++;
+}
+
+static void handle_status(const TnpMessage* message, gpointer user_data)
+{
+    BenchState* state = user_data;
+    tnp_status_cache_update(state->status_cache, message->args[0], message->args[1]);
+    state->status_messages++;
+}
+
+/**
+ * The mock client ends a flood with an UPDATE_VIEW: message.
+ */
+static void handle_update_view(const TnpMessage* message, gpointer user_data)
+{
+    BenchState* state = user_data;
+    state->floods_done++;
+}
+
+static const TnpMessageHandler message_handlers[TNP_MESSAGE_N_TYPES] =
+{
+    [TNP_MESSAGE_SHARE]       = handle_share,
+    [TNP_MESSAGE_STATUS]      = handle_status,
+    [TNP_MESSAGE_UPDATE_VIEW] = handle_update_view,
+};
+
+static void handle_client_events(TnpClientEvent** events, guint n_events, gpointer user_data)
+{
+    BenchState* state = user_data;
+    guint i;
+
+    for(i = 0; i < n_events; i++)
+    {
+        switch(events[i]->type)
+        {
+            case TNP_CLIENT_EVENT_SYNCED_DIRS:
+                state->roots = tnp_path_index_size(tnp_client_get_synced_dirs(state->client));
+                break;
+            case TNP_CLIENT_EVENT_MESSAGE:
+                tnp_message_dispatch(&events[i]->message, message_handlers, state);
+                break;
+            case TNP_CLIENT_EVENT_CONNECTED:
+            case TNP_CLIENT_EVENT_DISCONNECTED:
+            case TNP_CLIENT_EVENT_CONNECT_FAILED:
+                break;
+        }
+    }
+}
+
+static gboolean status_send(const gchar* data, gsize length, gpointer user_data)
+{
+    BenchState* state = user_data;
+    return tnp_client_send(state->client, g_strndup(data, length), length);
+}
+
+static gboolean bench_connect(BenchState* state, const gchar* socket_path)
+{
+    GArray* samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+    gint64 start, total = 0, sample;
+    gint i;
+
+    for(i = 0; i < n_connects; i++)
+    {
+        state->roots = 0;
+        start = now_ns();
+        state->client = tnp_client_new(handle_client_events, state);
+        tnp_client_add_socket(state->client, socket_path);
+        if(!wait_for(&state->roots, n_roots))
+        {
+            return FALSE;
+        }
+        sample = now_ns() - start;
+        g_array_append_val(samples, sample);
+        total += sample;
+        // the last connection is used by the following benchmarks
+        if(i + 1 < n_connects)
+        {
+            tnp_client_free(state->client);
+        }
+    }
+    report("connect", samples, n_connects, total);
+    g_array_free(samples, TRUE);
+    return TRUE;
+}
+
+static gboolean bench_share(BenchState* state)
+{
+    GArray* samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+    gint64 start, total = 0, sample;
+    gchar* command;
+    gint i;
+
+    state->share_replies = 0;
+    for(i = 0; i < n_shares; i++)
+    {
+        command = g_strdup_printf("SHARE:%s/dir/file%d\n", sync_roots[i % n_roots], i);
+        start = now_ns();
+        if(!tnp_client_send(state->client, command, strlen(command)) ||
+           !wait_for(&state->share_replies, i + 1))
+        {
+            return FALSE;
+        }
+        sample = now_ns() - start;
+        g_array_append_val(samples, sample);
+        total += sample;
+    }
+    report("share", samples, n_shares, total);
+    g_array_free(samples, TRUE);
+    return TRUE;
+}
+
+static gboolean bench_burst(BenchState* state)
+{
+    gint64 start;
+    gchar* command;
+    gint i;
+
+    state->share_replies = 0;
+    start = now_ns();
+    for(i = 0; i < n_shares; i++)
+    {
+        command = g_strdup_printf("SHARE:%s/dir/file%d\n", sync_roots[i % n_roots], i);
+        if(!tnp_client_send(state->client, command, strlen(command)))
+        {
+            return FALSE;
+        }
+    }
+    if(!wait_for(&state->share_replies, n_shares))
+    {
+        return FALSE;
+    }
+    report("burst", NULL, n_shares, now_ns() - start);
+    return TRUE;
+}
+
+static gboolean bench_flood(BenchState* state)
+{
+    gint64 start;
+    gchar* command;
+
+    state->status_messages = 0;
+    state->floods_done = 0;
+    command = g_strdup_printf("FLOOD:%d\n", n_flood);
+    start = now_ns();
+    if(!tnp_client_send(state->client, command, strlen(command)) ||
+       !wait_for(&state->floods_done, 1))
+    {
+        return FALSE;
+    }
+    report("flood", NULL, state->status_messages, now_ns() - start);
+    return TRUE;
+}
+
+static gboolean bench_menu(BenchState* state)
+{
+    GArray* samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+    TnpPathCache* path_cache = tnp_path_cache_new(32, state->arena);
+    gchar** uris = g_new0(gchar*, n_roots + 1);
+    char buffer[PATH_MAX];
+    const gchar* parent;
+    const gchar* root;
+    gboolean shared;
+    gint64 start, total = 0, sample;
+    gint i;
+
+    for(i = 0; i < n_roots; i++)
+    {
+        uris[i] = g_strdup_printf("file://%s/dir", sync_roots[i]);
+    }
+    for(i = 0; i < n_files; i++)
+    {
+        start = now_ns();
+        // what tnp_provider_get_file_menu_items() does for a single file
+        parent = tnp_path_cache_lookup(path_cache, uris[i % n_roots], tnp_client_get_synced_dirs(state->client), &root);
+        if(parent == NULL || root == NULL)
+        {
+            g_printerr("Failed to resolve %s\n", uris[i % n_roots]);
+            return FALSE;
+        }
+        g_snprintf(buffer, sizeof(buffer), "%s/file%d", parent, i);
+        tnp_status_cache_request(state->status_cache, parent, TRUE);
+        tnp_status_cache_request(state->status_cache, buffer, FALSE);
+        tnp_status_cache_get(state->status_cache, buffer, &shared);
+        sample = now_ns() - start;
+        g_array_append_val(samples, sample);
+        total += sample;
+        // let the batched requests go out like between two real menus
+        g_main_context_iteration(NULL, FALSE);
+    }
+    report("menu", samples, n_files, total);
+    tnp_path_cache_free(path_cache);
+    g_strfreev(uris);
+    g_array_free(samples, TRUE);
+    return TRUE;
+}
+
+int main(int argc, char** argv)
+{
+    GOptionContext* context;
+    GError* error = NULL;
+    BenchState state = { 0 };
+    gchar* runtime_dir;
+    gchar* socket_path;
+    gchar* path;
+    gboolean ok;
+    gint i;
+
+    context = g_option_context_new("- benchmark the thunar nextcloud plugin against a mock client");
+    g_option_context_add_main_entries(context, options, NULL);
+    if(!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+    g_option_context_free(context);
+    n_roots = MAX(n_roots, 1);
+    // TNP_STATS=1 writes the plugin's own statistics to the real runtime dir
+    tnp_stats_init();
+    // TNP_TRACE=<file> records the traffic with the mock client for tnp-replay
+    tnp_trace_init();
+
+    // everything lives in a temporary runtime dir, as the real client's socket would
+    runtime_dir = g_dir_make_tmp("tnp-bench-XXXXXX", &error);
+    if(runtime_dir == NULL)
+    {
+        g_printerr("%s\n", error->message);
+        return 1;
+    }
+    g_setenv("XDG_RUNTIME_DIR", runtime_dir, TRUE);
+    socket_path = g_build_filename(runtime_dir, "Nextcloud", "socket", NULL);
+    path = g_path_get_dirname(socket_path);
+    g_mkdir_with_parents(path, 0700);
+    g_free(path);
+    sync_roots = g_new0(gchar*, n_roots + 1);
+    for(i = 0; i < n_roots; i++)
+    {
+        sync_roots[i] = g_strdup_printf("%s/sync%d", runtime_dir, i);
+        path = g_build_filename(sync_roots[i], "dir", NULL);
+        g_mkdir_with_parents(path, 0700);
+        g_free(path);
+    }
+    if(!server_start(socket_path))
+    {
+        g_printerr("Failed to listen on %s\n", socket_path);
+        return 1;
+    }
+
+    state.arena = tnp_path_arena_new();
+    state.status_cache = tnp_status_cache_new(state.arena, status_send, NULL, &state);
+    ok = bench_connect(&state, socket_path) && bench_share(&state) && bench_burst(&state) && bench_flood(&state) && bench_menu(&state);
+
+    tnp_client_free(state.client);
+    tnp_status_cache_free(state.status_cache);
+    tnp_path_arena_free(state.arena);
+    tnp_stats_shutdown();
+    tnp_trace_shutdown();
+    shutdown(server_socket, SHUT_RDWR);
+    close(server_socket);
+    g_unlink(socket_path);
+    for(i = 0; i < n_roots; i++)
+    {
+        path = g_build_filename(sync_roots[i], "dir", NULL);
+        g_rmdir(path);
+        g_free(path);
+        g_rmdir(sync_roots[i]);
+    }
+    path = g_path_get_dirname(socket_path);
+    g_rmdir(path);
+    g_free(path);
+    g_rmdir(runtime_dir);
+    g_strfreev(sync_roots);
+    g_free(socket_path);
+    g_free(runtime_dir);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,932 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "tnp-client.h"
+#include "tnp-framer.h"
+#include "tnp-protocol.h"
+#include "tnp-queue.h"
+#include "tnp-stats.h"
+#include "tnp-trace.h"
+#include "tnp-writer.h"
+
+// "SHARE:CANNOTSHAREROOT:" + path + "\n\0"
+#define SOCKET_BUFFER_SIZE PATH_MAX+24
+// longer lines from the client are dropped
+#define SOCKET_BUFFER_MAX_SIZE 16*SOCKET_BUFFER_SIZE
+// bounds of the exponential reconnect backoff in milliseconds
+#define RECONNECT_MIN_DELAY 250
+#define RECONNECT_MAX_DELAY 30000
+
+typedef enum
+{
+    TNP_CLIENT_REQUEST_ADD,
+    TNP_CLIENT_REQUEST_SEND,
+    TNP_CLIENT_REQUEST_RECONNECT,
+    TNP_CLIENT_REQUEST_STOP,
+} TnpClientRequestType;
+
+typedef struct
+{
+    TnpClientRequestType type;
+    // target of TNP_CLIENT_REQUEST_SEND or TNP_CLIENT_CONNECTION_ANY
+    guint                connection;
+    // commands to send or the socket path to add
+    gchar*               data;
+    gsize                length;
+} TnpClientRequest;
+
+typedef enum
+{
+    TNP_CONNECTION_DISCONNECTED,
+    TNP_CONNECTION_CONNECTING,
+    TNP_CONNECTION_CONNECTED,
+    // waiting for the reconnect timer
+    TNP_CONNECTION_BACKOFF,
+} TnpConnectionState;
+
+typedef struct _TnpConnection TnpConnection;
+
+/**
+ * One socket of a Nextcloud client. Worker only.
+ */
+struct _TnpConnection
+{
+    TnpClient*          client;
+    guint               id;
+    gchar*              socket_path;
+    int                 socket;
+    TnpConnectionState  state;
+    TnpFramer*          framer;
+    TnpWriter*          outgoing;
+    gboolean            want_write;
+    gint64              reconnect_time;
+    guint               reconnect_delay;
+    // TNP_CLIENT_EVENT_CONNECT_FAILED was sent since the last connection
+    gboolean            failure_reported;
+};
+
+struct _TnpClient
+{
+    TnpClientEventFunc  event_func;
+    gpointer            user_data;
+    GThread*            thread;
+    int                 epoll_fd;
+    // written by the main context to wake up the worker
+    int                 wakeup_fd;
+    // main context -> worker
+    TnpQueue*           requests;
+    // worker -> main context
+    TnpQueue*           events;
+    // set while a dispatch of the events is scheduled
+    gint                dispatch_pending;
+    gint                dispatch_id;
+    // latest snapshot of the sync roots, swapped atomically by the worker
+    TnpPathIndex*       published_dirs;
+
+    // main context only
+    // socket paths of the connections, indexed by connection
+    GPtrArray*          socket_paths;
+    // whether each connection is connected, indexed by connection
+    GArray*             connected;
+    guint               n_connected;
+
+    // worker only
+    // TnpConnection, indexed by connection
+    GPtrArray*          connections;
+    // sync roots of all connections, owned by the connection that registered them
+    TnpPathIndex*       synced_dirs;
+    gboolean            synced_dirs_changed;
+    gboolean            events_pushed;
+    gboolean            stopping;
+};
+
+static void tnp_client_request_free(gpointer data)
+{
+    TnpClientRequest* request = data;
+    g_free(request->data);
+    g_slice_free(TnpClientRequest, request);
+}
+
+static void tnp_connection_free(gpointer data)
+{
+    TnpConnection* connection = data;
+    if(connection->socket >= 0)
+    {
+        close(connection->socket);
+    }
+    tnp_framer_free(connection->framer);
+    tnp_writer_free(connection->outgoing);
+    g_free(connection->socket_path);
+    g_slice_free(TnpConnection, connection);
+}
+
+static void tnp_client_event_free(gpointer data)
+{
+    TnpClientEvent* event = data;
+    g_free(event->line);
+    tnp_path_index_free(event->retired);
+    g_slice_free(TnpClientEvent, event);
+}
+
+/**
+ * Hands all events that arrived so far to the event function. Runs in the main
+ * context.
+ */
+static gboolean tnp_client_dispatch(gpointer user_data)
+{
+    TnpClient* client = user_data;
+    TnpClientEvent* event;
+    GPtrArray* batch;
+
+    // events pushed from now on need another dispatch
+    g_atomic_int_set(&client->dispatch_pending, FALSE);
+    batch = g_ptr_array_new_with_free_func(tnp_client_event_free);
+    while((event = tnp_queue_pop(client->events)) != NULL)
+    {
+        if(event->type == TNP_CLIENT_EVENT_CONNECTED)
+        {
+            g_array_index(client->connected, gboolean, event->connection) = TRUE;
+            client->n_connected++;
+        }
+        else if(event->type == TNP_CLIENT_EVENT_DISCONNECTED)
+        {
+            g_array_index(client->connected, gboolean, event->connection) = FALSE;
+            client->n_connected--;
+        }
+        g_ptr_array_add(batch, event);
+    }
+    if(batch->len > 0)
+    {
+        client->event_func((TnpClientEvent**) batch->pdata, batch->len, client->user_data);
+    }
+    // the main context does not hold on to retired snapshots past this point
+    g_ptr_array_free(batch, TRUE);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Queues an event for the main context. Worker only.
+ */
+static void tnp_client_push_event(TnpClient* client, TnpClientEventType type, guint connection, TnpPathIndex* retired)
+{
+    TnpClientEvent* event = g_slice_new0(TnpClientEvent);
+    event->type = type;
+    event->connection = connection;
+    event->retired = retired;
+    tnp_queue_push(client->events, event);
+    client->events_pushed = TRUE;
+}
+
+/**
+ * Queues a parsed message for the main context. The "length" bytes of "line"
+ * are copied and the arguments moved along with them. Worker only.
+ */
+static void tnp_client_push_message(TnpConnection* connection, const TnpMessage* message, const gchar* line, gsize length)
+{
+    TnpClient* client = connection->client;
+    TnpClientEvent* event = g_slice_new0(TnpClientEvent);
+    guint i;
+
+    event->type = TNP_CLIENT_EVENT_MESSAGE;
+    event->connection = connection->id;
+    event->line = g_malloc(length + 1);
+    memcpy(event->line, line, length + 1);
+    event->message = *message;
+    for(i = 0; i < message->n_args; i++)
+    {
+        event->message.args[i] = event->line + (message->args[i] - line);
+    }
+    tnp_queue_push(client->events, event);
+    client->events_pushed = TRUE;
+}
+
+/**
+ * Publishes the sync roots if they changed and wakes up the main context if
+ * there are new events. Called once per worker iteration, so a burst of
+ * messages results in one snapshot and one dispatch.
+ */
+static void tnp_client_publish(TnpClient* client)
+{
+    TnpPathIndex* retired;
+
+    if(client->synced_dirs_changed)
+    {
+        client->synced_dirs_changed = FALSE;
+        retired = g_atomic_pointer_exchange(&client->published_dirs, tnp_path_index_copy(client->synced_dirs));
+        // the main context may still be reading the old snapshot, it frees it
+        // once the event has been dispatched
+        tnp_client_push_event(client, TNP_CLIENT_EVENT_SYNCED_DIRS, TNP_CLIENT_CONNECTION_ANY, retired);
+    }
+    if(client->events_pushed)
+    {
+        client->events_pushed = FALSE;
+        if(g_atomic_int_compare_and_exchange(&client->dispatch_pending, FALSE, TRUE))
+        {
+            g_atomic_int_set(&client->dispatch_id, g_idle_add(tnp_client_dispatch, client));
+        }
+    }
+}
+
+/**
+ * Closes the connection and forgets the sync roots it registered. Worker only.
+ */
+static void tnp_connection_disconnect(TnpConnection* connection)
+{
+    TnpClient* client = connection->client;
+
+    if(connection->socket >= 0)
+    {
+        epoll_ctl(client->epoll_fd, EPOLL_CTL_DEL, connection->socket, NULL);
+        close(connection->socket);
+        tnp_trace_record(TNP_TRACE_DISCONNECTED, connection->id, NULL, 0);
+        tnp_client_push_event(client, TNP_CLIENT_EVENT_DISCONNECTED, connection->id, NULL);
+    }
+    connection->socket = -1;
+    connection->state = TNP_CONNECTION_DISCONNECTED;
+    connection->want_write = FALSE;
+    tnp_framer_reset(connection->framer);
+    // a half written command must not be continued on the next connection
+    tnp_writer_reset(connection->outgoing);
+    // delete its synced dirs
+    if(tnp_path_index_remove_owner(client->synced_dirs, connection->id) > 0)
+    {
+        client->synced_dirs_changed = TRUE;
+    }
+}
+
+/**
+ * Schedules the next connection attempt. The delay doubles with every failed
+ * attempt up to RECONNECT_MAX_DELAY and is randomized so that many Thunar
+ * processes do not hit a restarting client at the same time. Worker only.
+ */
+static void tnp_connection_schedule_reconnect(TnpConnection* connection)
+{
+    guint delay;
+
+    // wait between half and all of the current delay
+    delay = connection->reconnect_delay / 2 + g_random_int_range(0, connection->reconnect_delay / 2 + 1);
+    connection->reconnect_delay = MIN(connection->reconnect_delay * 2, RECONNECT_MAX_DELAY);
+    connection->reconnect_time = g_get_monotonic_time() + (gint64) delay * 1000;
+    connection->state = TNP_CONNECTION_BACKOFF;
+    #ifdef G_ENABLE_DEBUG
+    g_message("Reconnecting to '%s' in %u ms", connection->socket_path, delay);
+    #endif
+}
+
+/**
+ * Tells the main context about the first of a series of failed connection
+ * attempts and schedules the next one. Worker only.
+ */
+static void tnp_connection_connect_failed(TnpConnection* connection)
+{
+    if(!connection->failure_reported)
+    {
+        connection->failure_reported = TRUE;
+        tnp_client_push_event(connection->client, TNP_CLIENT_EVENT_CONNECT_FAILED, connection->id, NULL);
+    }
+    tnp_connection_schedule_reconnect(connection);
+}
+
+/**
+ * Connects to the unix socket of a Nextcloud client, scheduling a reconnect
+ * if that fails. Worker only.
+ */
+static void tnp_connection_connect(TnpConnection* connection)
+{
+    // taken from the unix(7) manpage
+    struct sockaddr_un addr;
+    struct epoll_event event;
+
+    connection->state = TNP_CONNECTION_CONNECTING;
+    connection->socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(connection->socket == -1)
+    {
+        #ifdef G_ENABLE_DEBUG
+        g_message("socket() failed! %s", strerror(errno));
+        #endif
+        tnp_connection_connect_failed(connection);
+        return;
+    }
+
+    /*
+    * For portability clear the whole structure, since some
+    * implementations have additional (nonstandard) fields in
+    * the structure.
+    */
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+
+    /* Connect socket to socket address */
+    addr.sun_family = AF_UNIX;
+    g_strlcpy(addr.sun_path, connection->socket_path, sizeof(addr.sun_path));
+    // connecting a unix socket completes (or fails) immediately
+    if(connect(connection->socket, (const struct sockaddr*) &addr, sizeof(struct sockaddr_un)) == -1)
+    {
+        #ifdef G_ENABLE_DEBUG
+        g_message("connect() failed! %s", strerror(errno));
+        #endif
+        close(connection->socket);
+        connection->socket = -1;
+        tnp_connection_connect_failed(connection);
+        return;
+    }
+    #ifdef G_ENABLE_DEBUG
+    g_message("Connected to '%s'", addr.sun_path);
+    #endif
+    event.events = EPOLLIN;
+    event.data.ptr = connection;
+    epoll_ctl(connection->client->epoll_fd, EPOLL_CTL_ADD, connection->socket, &event);
+    connection->state = TNP_CONNECTION_CONNECTED;
+    connection->reconnect_delay = RECONNECT_MIN_DELAY;
+    connection->failure_reported = FALSE;
+    tnp_trace_record(TNP_TRACE_CONNECTED, connection->id, connection->socket_path, strlen(connection->socket_path));
+    tnp_client_push_event(connection->client, TNP_CLIENT_EVENT_CONNECTED, connection->id, NULL);
+}
+
+/**
+ * Registers interest in EPOLLOUT while there is unsent data. Worker only.
+ */
+static void tnp_connection_set_want_write(TnpConnection* connection, gboolean want_write)
+{
+    struct epoll_event event;
+
+    if(connection->want_write == want_write)
+    {
+        return;
+    }
+    connection->want_write = want_write;
+    event.events = want_write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.ptr = connection;
+    epoll_ctl(connection->client->epoll_fd, EPOLL_CTL_MOD, connection->socket, &event);
+}
+
+/**
+ * Writes as much outgoing data as the socket accepts. Worker only.
+ */
+static void tnp_connection_flush(TnpConnection* connection)
+{
+    if(connection->state != TNP_CONNECTION_CONNECTED)
+    {
+        return;
+    }
+    switch(tnp_writer_flush(connection->outgoing, connection->socket))
+    {
+        case TNP_WRITER_FLUSHED:
+            tnp_connection_set_want_write(connection, FALSE);
+            break;
+        case TNP_WRITER_BLOCKED:
+            // resume once the socket becomes writable
+            tnp_connection_set_want_write(connection, TRUE);
+            break;
+        case TNP_WRITER_FAILED:
+            #ifdef G_ENABLE_DEBUG
+            g_message("Failed to send to the client: %s", strerror(errno));
+            #endif
+            tnp_connection_disconnect(connection);
+            tnp_connection_schedule_reconnect(connection);
+            break;
+    }
+}
+
+/**
+ * Adds a newly synced directory. Worker only.
+ */
+static void tnp_client_register_path(const TnpMessage* message, gpointer user_data)
+{
+    TnpConnection* connection = user_data;
+    TnpClient* client = connection->client;
+    char realpath_buffer[PATH_MAX];
+    char* path = message->args[0];
+    char* resolved;
+    gint64 start;
+
+    // dereference directory
+    start = tnp_stats_start();
+    resolved = realpath(path, realpath_buffer);
+    tnp_stats_record(TNP_STATS_REALPATH, start);
+    if(resolved == NULL)
+    {
+        #ifdef G_ENABLE_DEBUG
+        g_message("Failed to resolve path: %s", path);
+        #endif
+    }
+    else if(tnp_path_index_insert(client->synced_dirs, realpath_buffer, connection->id))
+    {
+        #ifdef G_ENABLE_DEBUG
+        g_message("Added directory: %s", realpath_buffer);
+        #endif
+        client->synced_dirs_changed = TRUE;
+    }
+}
+
+/**
+ * Removes a directory that is no longer synced. Worker only.
+ */
+static void tnp_client_unregister_path(const TnpMessage* message, gpointer user_data)
+{
+    TnpConnection* connection = user_data;
+    TnpClient* client = connection->client;
+    char realpath_buffer[PATH_MAX];
+    char* path = message->args[0];
+    char* resolved;
+    gint64 start;
+
+    start = tnp_stats_start();
+    resolved = realpath(path, realpath_buffer);
+    tnp_stats_record(TNP_STATS_REALPATH, start);
+    // the directory may already be gone, so fall back to the path as sent
+    // only this client's registration is dropped, others may sync the same directory
+    if(tnp_path_index_remove(client->synced_dirs, resolved != NULL ? realpath_buffer : path, connection->id) ||
+       tnp_path_index_remove(client->synced_dirs, path, connection->id))
+    {
+        #ifdef G_ENABLE_DEBUG
+        g_message("Removed directory: %s", path);
+        #endif
+        client->synced_dirs_changed = TRUE;
+    }
+}
+
+// messages handled by the worker itself, all others go to the main context
+static const TnpMessageHandler worker_handlers[TNP_MESSAGE_N_TYPES] =
+{
+    [TNP_MESSAGE_REGISTER_PATH]   = tnp_client_register_path,
+    [TNP_MESSAGE_UNREGISTER_PATH] = tnp_client_unregister_path,
+};
+
+/**
+ * Handles a single line of "length" bytes received from the client. Each line
+ * is parsed exactly once; the main context receives the parsed message.
+ * Worker only.
+ */
+static void tnp_connection_handle_line(TnpConnection* connection, gchar* line, gsize length)
+{
+    TnpMessage message;
+
+    tnp_stats_add(TNP_STATS_MESSAGES, 1);
+    if(!tnp_message_parse(line, &message))
+    {
+        #ifdef G_ENABLE_DEBUG
+        g_message("Ignoring message: %s", line);
+        #endif
+        return;
+    }
+    if(!tnp_message_dispatch(&message, worker_handlers, connection))
+    {
+        tnp_client_push_message(connection, &message, line, length);
+    }
+}
+
+/**
+ * Reads and handles everything currently available on the socket. Worker only.
+ */
+static void tnp_connection_read(TnpConnection* connection)
+{
+    gchar* buffer;
+    gchar* line;
+    gsize available, length;
+    ssize_t ret;
+
+    while(connection->state == TNP_CONNECTION_CONNECTED)
+    {
+        // try to fill the buffer
+        buffer = tnp_framer_reserve(connection->framer, &available);
+        ret = recv(connection->socket, buffer, available, 0);
+        if(ret > 0)
+        {
+            tnp_stats_add(TNP_STATS_BYTES_PARSED, ret);
+            tnp_trace_record(TNP_TRACE_RECEIVED, connection->id, buffer, ret);
+            tnp_framer_commit(connection->framer, ret);
+            // repeat as long as there are complete lines in the buffer
+            while((line = tnp_framer_next_line(connection->framer, &length)) != NULL)
+            {
+                tnp_connection_handle_line(connection, line, length);
+            }
+        }
+        else if(ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        // a closed connection reads as 0 bytes
+        else
+        {
+            #ifdef G_ENABLE_DEBUG
+            g_message("Lost connection to '%s'", connection->socket_path);
+            #endif
+            tnp_connection_disconnect(connection);
+            tnp_connection_schedule_reconnect(connection);
+        }
+    }
+}
+
+/**
+ * Finds the connection a command line should go to: the one that registered
+ * the sync root of the path following the command, or the first connected one
+ * if the path is not synced by any of them. Worker only.
+ * @return The connection or NULL if none is connected
+ */
+static TnpConnection* tnp_client_route(TnpClient* client, const gchar* line, gsize length)
+{
+    TnpConnection* connection;
+    gchar path[PATH_MAX];
+    const gchar* start;
+    const gchar* end;
+    const gchar* separator;
+    gsize path_length;
+    guint owner, i;
+
+    start = memchr(line, ':', length);
+    if(start != NULL)
+    {
+        start++;
+        // the line need not be terminated, so never look beyond "length"
+        end = memchr(start, '\n', line + length - start);
+        if(end == NULL)
+        {
+            end = line + length;
+        }
+        // only the first of several paths counts, see TNP_MENU_PATH_SEPARATOR
+        separator = memchr(start, '\x1e', end - start);
+        path_length = (separator != NULL ? separator : end) - start;
+        if(path_length < sizeof(path))
+        {
+            memcpy(path, start, path_length);
+            path[path_length] = '\0';
+            if(tnp_path_index_lookup_owner(client->synced_dirs, path, &owner) != NULL)
+            {
+                return g_ptr_array_index(client->connections, owner);
+            }
+        }
+    }
+    for(i = 0; i < client->connections->len; i++)
+    {
+        connection = g_ptr_array_index(client->connections, i);
+        if(connection->state == TNP_CONNECTION_CONNECTED)
+        {
+            return connection;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Queues the commands of a send request on the connections they belong to.
+ * Worker only.
+ */
+static void tnp_client_queue_commands(TnpClient* client, TnpClientRequest* request)
+{
+    TnpConnection* connection;
+    GBytes* bytes;
+    const gchar* data = request->data;
+    const gchar* data_end = data + request->length;
+    const gchar* line;
+    const gchar* end;
+
+    // the writers queue slices of the request instead of copies
+    bytes = g_bytes_new_take(request->data, request->length);
+    request->data = NULL;
+    if(request->connection != TNP_CLIENT_CONNECTION_ANY || client->connections->len == 1)
+    {
+        connection = g_ptr_array_index(client->connections,
+                                       request->connection != TNP_CLIENT_CONNECTION_ANY ? request->connection : 0);
+        // commands sent while disconnected are lost like their replies
+        if(connection->state == TNP_CONNECTION_CONNECTED)
+        {
+            tnp_writer_push(connection->outgoing, bytes, 0, request->length);
+        }
+        g_bytes_unref(bytes);
+        return;
+    }
+    // route every line on its own, consecutive lines for the same connection
+    // are merged by its writer
+    for(line = data; line < data_end; line = end)
+    {
+        end = memchr(line, '\n', data_end - line);
+        end = end != NULL ? end + 1 : data_end;
+        connection = tnp_client_route(client, line, end - line);
+        if(connection != NULL)
+        {
+            tnp_writer_push(connection->outgoing, bytes, line - data, end - line);
+        }
+    }
+    g_bytes_unref(bytes);
+}
+
+/**
+ * Creates a connection for "socket_path" and connects it. Worker only.
+ */
+static void tnp_client_add_connection(TnpClient* client, gchar* socket_path)
+{
+    TnpConnection* connection = g_slice_new0(TnpConnection);
+
+    connection->client = client;
+    connection->id = client->connections->len;
+    connection->socket_path = socket_path;
+    connection->socket = -1;
+    connection->framer = tnp_framer_new(SOCKET_BUFFER_SIZE, SOCKET_BUFFER_MAX_SIZE);
+    connection->outgoing = tnp_writer_new(connection->id);
+    connection->reconnect_delay = RECONNECT_MIN_DELAY;
+    g_ptr_array_add(client->connections, connection);
+    tnp_connection_connect(connection);
+}
+
+/**
+ * Takes all requests from the main context. Worker only.
+ */
+static void tnp_client_process_requests(TnpClient* client)
+{
+    TnpClientRequest* request;
+    TnpConnection* connection;
+    guint i;
+
+    while((request = tnp_queue_pop(client->requests)) != NULL)
+    {
+        switch(request->type)
+        {
+            case TNP_CLIENT_REQUEST_ADD:
+                tnp_client_add_connection(client, request->data);
+                // the connection owns the path now
+                request->data = NULL;
+                break;
+            case TNP_CLIENT_REQUEST_SEND:
+                tnp_client_queue_commands(client, request);
+                break;
+            case TNP_CLIENT_REQUEST_RECONNECT:
+                for(i = 0; i < client->connections->len; i++)
+                {
+                    connection = g_ptr_array_index(client->connections, i);
+                    if(connection->state == TNP_CONNECTION_BACKOFF)
+                    {
+                        connection->reconnect_delay = RECONNECT_MIN_DELAY;
+                        connection->reconnect_time = 0;
+                    }
+                }
+                break;
+            case TNP_CLIENT_REQUEST_STOP:
+                client->stopping = TRUE;
+                break;
+        }
+        tnp_client_request_free(request);
+    }
+    for(i = 0; i < client->connections->len; i++)
+    {
+        tnp_connection_flush(g_ptr_array_index(client->connections, i));
+    }
+}
+
+/**
+ * Reconnects all connections whose backoff delay has passed.
+ * @return The time until the next reconnect is due in ms or -1 if none is
+ */
+static int tnp_client_reconnect_due(TnpClient* client)
+{
+    TnpConnection* connection;
+    gint64 now = g_get_monotonic_time();
+    gint64 next = G_MAXINT64;
+    guint i;
+
+    for(i = 0; i < client->connections->len; i++)
+    {
+        connection = g_ptr_array_index(client->connections, i);
+        if(connection->state != TNP_CONNECTION_BACKOFF)
+        {
+            continue;
+        }
+        if(now >= connection->reconnect_time)
+        {
+            tnp_stats_add(TNP_STATS_RECONNECTS, 1);
+            tnp_connection_connect(connection);
+        }
+        if(connection->state == TNP_CONNECTION_BACKOFF)
+        {
+            next = MIN(next, connection->reconnect_time);
+        }
+    }
+    return next == G_MAXINT64 ? -1 : (int) MAX((next - now + 999) / 1000, 0);
+}
+
+static gpointer tnp_client_thread(gpointer user_data)
+{
+    TnpClient* client = user_data;
+    TnpConnection* connection;
+    struct epoll_event events[8];
+    guint64 counter;
+    int timeout, n, i;
+
+    timeout = -1;
+    while(!client->stopping)
+    {
+        n = epoll_wait(client->epoll_fd, events, G_N_ELEMENTS(events), timeout);
+        for(i = 0; i < n; i++)
+        {
+            // the wakeup fd is registered without a connection
+            connection = events[i].data.ptr;
+            if(connection == NULL)
+            {
+                if(read(client->wakeup_fd, &counter, sizeof(counter)) < 0)
+                {
+                    // nothing to do, the counter is reset either way
+                }
+                tnp_client_process_requests(client);
+                continue;
+            }
+            if(events[i].events & EPOLLOUT)
+            {
+                tnp_connection_flush(connection);
+            }
+            if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                tnp_connection_read(connection);
+            }
+        }
+        timeout = client->stopping ? -1 : tnp_client_reconnect_due(client);
+        tnp_client_publish(client);
+        tnp_trace_flush();
+    }
+    return NULL;
+}
+
+/**
+ * Creates a client without connections and starts its worker thread, which
+ * serves all connections added with tnp_client_add_socket() from a single
+ * epoll loop. "event_func" is called in the main context.
+ */
+TnpClient* tnp_client_new(TnpClientEventFunc event_func, gpointer user_data)
+{
+    TnpClient* client = g_slice_new0(TnpClient);
+    struct epoll_event event;
+
+    client->event_func = event_func;
+    client->user_data = user_data;
+    client->requests = tnp_queue_new();
+    client->events = tnp_queue_new();
+    client->published_dirs = tnp_path_index_new();
+    client->socket_paths = g_ptr_array_new_with_free_func(g_free);
+    client->connected = g_array_new(FALSE, TRUE, sizeof(gboolean));
+    client->connections = g_ptr_array_new_with_free_func(tnp_connection_free);
+    client->synced_dirs = tnp_path_index_new();
+    client->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    client->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, client->wakeup_fd, &event);
+    client->thread = g_thread_new("tnp-client", tnp_client_thread, client);
+    return client;
+}
+
+static void tnp_client_push_request(TnpClient* client,
+                                    TnpClientRequestType type,
+                                    guint connection,
+                                    gchar* data,
+                                    gsize length)
+{
+    TnpClientRequest* request = g_slice_new(TnpClientRequest);
+    guint64 one = 1;
+
+    request->type = type;
+    request->connection = connection;
+    request->data = data;
+    request->length = length;
+    tnp_queue_push(client->requests, request);
+    if(write(client->wakeup_fd, &one, sizeof(one)) < 0)
+    {
+        // the counter only overflows if the worker is gone
+    }
+}
+
+/**
+ * Stops the worker thread, closes all connections and frees the client.
+ * Events that were not dispatched yet are dropped.
+ */
+void tnp_client_free(TnpClient* client)
+{
+    if(client == NULL)
+    {
+        return;
+    }
+    tnp_client_push_request(client, TNP_CLIENT_REQUEST_STOP, TNP_CLIENT_CONNECTION_ANY, NULL, 0);
+    g_thread_join(client->thread);
+    if(g_atomic_int_get(&client->dispatch_pending))
+    {
+        g_source_remove(g_atomic_int_get(&client->dispatch_id));
+    }
+    close(client->wakeup_fd);
+    close(client->epoll_fd);
+    tnp_queue_free(client->requests, tnp_client_request_free);
+    tnp_queue_free(client->events, tnp_client_event_free);
+    tnp_path_index_free(client->published_dirs);
+    tnp_path_index_free(client->synced_dirs);
+    g_ptr_array_free(client->connections, TRUE);
+    g_ptr_array_free(client->socket_paths, TRUE);
+    g_array_free(client->connected, TRUE);
+    g_slice_free(TnpClient, client);
+}
+
+/**
+ * Adds a connection to the client socket at "socket_path", which is
+ * connected right away and reconnected whenever it is lost. Adding a socket
+ * twice returns the existing connection.
+ * @return The connection, as found in the events
+ */
+guint tnp_client_add_socket(TnpClient* client, const gchar* socket_path)
+{
+    guint i;
+
+    for(i = 0; i < client->socket_paths->len; i++)
+    {
+        if(strcmp(g_ptr_array_index(client->socket_paths, i), socket_path) == 0)
+        {
+            return i;
+        }
+    }
+    g_ptr_array_add(client->socket_paths, g_strdup(socket_path));
+    g_array_set_size(client->connected, client->socket_paths->len);
+    tnp_client_push_request(client, TNP_CLIENT_REQUEST_ADD, TNP_CLIENT_CONNECTION_ANY, g_strdup(socket_path), 0);
+    return i;
+}
+
+/**
+ * Returns whether any connection is connected, as of the last dispatched
+ * event.
+ */
+gboolean tnp_client_is_connected(const TnpClient* client)
+{
+    return client->n_connected > 0;
+}
+
+/**
+ * Queues "length" bytes of commands for sending and takes ownership of
+ * "data". Every line goes to the connection that registered the sync root of
+ * its path. Never blocks.
+ * @return FALSE if no connection is connected, in which case "data" is freed
+ */
+gboolean tnp_client_send(TnpClient* client, gchar* data, gsize length)
+{
+    return tnp_client_send_to(client, TNP_CLIENT_CONNECTION_ANY, data, length);
+}
+
+/**
+ * Like tnp_client_send(), but sends all commands to "connection", unless it
+ * is TNP_CLIENT_CONNECTION_ANY.
+ * @return FALSE if the connection is not connected, in which case "data" is
+ *         freed
+ */
+gboolean tnp_client_send_to(TnpClient* client, guint connection, gchar* data, gsize length)
+{
+    if(connection == TNP_CLIENT_CONNECTION_ANY ? client->n_connected == 0 :
+                                                 !g_array_index(client->connected, gboolean, connection))
+    {
+        g_free(data);
+        return FALSE;
+    }
+    tnp_client_push_request(client, TNP_CLIENT_REQUEST_SEND, connection, data, length);
+    return TRUE;
+}
+
+/**
+ * Skips the remaining backoff delay and reconnects as soon as possible.
+ */
+void tnp_client_reconnect(TnpClient* client)
+{
+    tnp_client_push_request(client, TNP_CLIENT_REQUEST_RECONNECT, TNP_CLIENT_CONNECTION_ANY, NULL, 0);
+}
+
+/**
+ * Returns the latest published snapshot of the sync roots of all connections
+ * without locking. The owner of each root is the connection that registered
+ * it. The snapshot stays valid at least until control returns to the main
+ * loop.
+ */
+const TnpPathIndex* tnp_client_get_synced_dirs(const TnpClient* client)
+{
+    return g_atomic_pointer_get(&client->published_dirs);
+}
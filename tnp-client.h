@@ -0,0 +1,89 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_CLIENT_H__
+#define __TNP_CLIENT_H__
+
+#include <glib.h>
+
+#include "tnp-path-index.h"
+#include "tnp-protocol.h"
+
+G_BEGIN_DECLS;
+
+/**
+ * Connections to the sockets of one or more Nextcloud clients (e.g. the
+ * standard and a branded one). All socket I/O happens on a dedicated worker
+ * thread that polls every connection from one epoll loop; requests reach it
+ * through a lock-free queue and events are delivered to the main context in
+ * batches.
+ *
+ * Thread-safety: all functions must be called from the main context. The
+ * worker thread maintains the sync roots registered by the clients and
+ * publishes them as immutable snapshots.
+ */
+typedef struct _TnpClient TnpClient;
+
+// events not related to a single connection, and sending to any connection
+#define TNP_CLIENT_CONNECTION_ANY G_MAXUINT
+
+typedef enum
+{
+    TNP_CLIENT_EVENT_CONNECTED,
+    TNP_CLIENT_EVENT_DISCONNECTED,
+    // connecting failed, reported once until the connection succeeds
+    TNP_CLIENT_EVENT_CONNECT_FAILED,
+    // a new snapshot of the sync roots has been published
+    TNP_CLIENT_EVENT_SYNCED_DIRS,
+    // any other known message received from the client
+    TNP_CLIENT_EVENT_MESSAGE,
+} TnpClientEventType;
+
+typedef struct
+{
+    TnpClientEventType type;
+    // the connection the event belongs to, see tnp_client_add_socket()
+    guint              connection;
+    // the parsed message for TNP_CLIENT_EVENT_MESSAGE
+    TnpMessage         message;
+    // private, holds the arguments of "message"
+    gchar*             line;
+    // private
+    TnpPathIndex*      retired;
+} TnpClientEvent;
+
+/**
+ * Receives the events that arrived since the last call, oldest first. The
+ * events are owned by the client; the message arguments may be modified.
+ */
+typedef void (*TnpClientEventFunc) (TnpClientEvent** events, guint n_events, gpointer user_data);
+
+TnpClient* tnp_client_new (TnpClientEventFunc event_func, gpointer user_data) G_GNUC_INTERNAL;
+void tnp_client_free (TnpClient* client) G_GNUC_INTERNAL;
+guint tnp_client_add_socket (TnpClient* client, const gchar* socket_path) G_GNUC_INTERNAL;
+gboolean tnp_client_is_connected (const TnpClient* client) G_GNUC_INTERNAL;
+gboolean tnp_client_send (TnpClient* client, gchar* data, gsize length) G_GNUC_INTERNAL;
+gboolean tnp_client_send_to (TnpClient* client, guint connection, gchar* data, gsize length) G_GNUC_INTERNAL;
+void tnp_client_reconnect (TnpClient* client) G_GNUC_INTERNAL;
+const TnpPathIndex* tnp_client_get_synced_dirs (const TnpClient* client) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_CLIENT_H__ */
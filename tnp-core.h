@@ -0,0 +1,48 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_CORE_H__
+#define __TNP_CORE_H__
+
+/**
+ * The parts of the plugin that neither need Thunar nor GTK, built as
+ * libtnp-core.a by compile.sh: the socket client and its framer and writer,
+ * the protocol parser, the sync roots and the path, status and menu caches,
+ * the round-trip estimate, plus the statistics and traces. Only GLib/GIO are
+ * required, so everything can be tested (tnp-test), benchmarked (tnp-bench,
+ * tnp-microbench) and replayed (tnp-replay) on a headless machine. The Thunar glue lives in tnp-provider.c.
+ */
+
+#include "tnp-client.h"
+#include "tnp-framer.h"
+#include "tnp-menu.h"
+#include "tnp-path-arena.h"
+#include "tnp-path-cache.h"
+#include "tnp-path-index.h"
+#include "tnp-protocol.h"
+#include "tnp-queue.h"
+#include "tnp-root-snapshot.h"
+#include "tnp-rtt.h"
+#include "tnp-stats.h"
+#include "tnp-status.h"
+#include "tnp-trace.h"
+#include "tnp-writer.h"
+
+#endif /* !__TNP_CORE_H__ */
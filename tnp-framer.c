@@ -0,0 +1,175 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "tnp-framer.h"
+
+struct _TnpFramer
+{
+    gchar*   data;
+    gsize    capacity;
+    gsize    max_capacity;
+    // unconsumed data is data[start..end), data[start..scan) has no newline
+    gsize    start;
+    gsize    scan;
+    gsize    end;
+    // set while skipping the rest of a line that did not fit
+    gboolean discarding;
+    guint    dropped;
+};
+
+/**
+ * Creates a framer whose buffer starts at "initial_size" bytes and grows up to
+ * "max_size" bytes. Lines longer than "max_size" are dropped.
+ */
+TnpFramer* tnp_framer_new(gsize initial_size, gsize max_size)
+{
+    TnpFramer* framer = g_slice_new0(TnpFramer);
+    framer->capacity = MAX(initial_size, 64);
+    framer->max_capacity = MAX(max_size, framer->capacity);
+    framer->data = g_malloc(framer->capacity);
+    return framer;
+}
+
+void tnp_framer_free(TnpFramer* framer)
+{
+    if(framer == NULL)
+    {
+        return;
+    }
+    g_free(framer->data);
+    g_slice_free(TnpFramer, framer);
+}
+
+/**
+ * Drops all buffered data, e.g. after reconnecting.
+ */
+void tnp_framer_reset(TnpFramer* framer)
+{
+    framer->start = framer->scan = framer->end = 0;
+    framer->discarding = FALSE;
+}
+
+/**
+ * Returns the free space at the end of the buffer that the next read should
+ * fill, making room first if necessary. The partial line at the front is only
+ * moved when the buffer is full, so moving costs are amortized over many lines.
+ * Lines returned by tnp_framer_next_line() are invalidated.
+ * @param available Set to the number of bytes that may be written
+ */
+gchar* tnp_framer_reserve(TnpFramer* framer, gsize* available)
+{
+    if(framer->start == framer->end)
+    {
+        framer->start = framer->scan = framer->end = 0;
+    }
+    if(framer->end == framer->capacity)
+    {
+        if(framer->start > 0)
+        {
+            memmove(framer->data, framer->data + framer->start, framer->end - framer->start);
+            framer->end -= framer->start;
+            framer->scan -= framer->start;
+            framer->start = 0;
+        }
+        else if(framer->capacity < framer->max_capacity)
+        {
+            framer->capacity = MIN(framer->capacity * 2, framer->max_capacity);
+            framer->data = g_realloc(framer->data, framer->capacity);
+        }
+        else
+        {
+            // a single line fills the whole buffer, skip it up to its newline
+            #ifdef G_ENABLE_DEBUG
+            g_message("Dropping line longer than %" G_GSIZE_FORMAT " bytes", framer->max_capacity);
+            #endif
+            framer->start = framer->scan = framer->end = 0;
+            framer->discarding = TRUE;
+            framer->dropped++;
+        }
+    }
+    *available = framer->capacity - framer->end;
+    return framer->data + framer->end;
+}
+
+/**
+ * Marks "length" bytes written to the space returned by tnp_framer_reserve()
+ * as received.
+ */
+void tnp_framer_commit(TnpFramer* framer, gsize length)
+{
+    framer->end += MIN(length, framer->capacity - framer->end);
+}
+
+/**
+ * Returns the next complete line with its line terminator ("\n" or "\r\n")
+ * replaced by '\0'. The line stays valid until the next call to
+ * tnp_framer_reserve().
+ * @param length Set to the length of the line (optional)
+ * @return The line or NULL if no complete line is buffered
+ */
+gchar* tnp_framer_next_line(TnpFramer* framer, gsize* length)
+{
+    gchar* line;
+    gchar* newline;
+    gsize line_length;
+
+    while(TRUE)
+    {
+        newline = memchr(framer->data + framer->scan, '\n', framer->end - framer->scan);
+        if(newline == NULL)
+        {
+            framer->scan = framer->end;
+            if(framer->discarding)
+            {
+                // everything buffered belongs to the oversize line
+                framer->start = framer->scan = framer->end = 0;
+            }
+            return NULL;
+        }
+        line = framer->data + framer->start;
+        line_length = newline - line;
+        *newline = '\0';
+        framer->start = framer->scan = newline - framer->data + 1;
+        if(framer->discarding)
+        {
+            framer->discarding = FALSE;
+            continue;
+        }
+        if(line_length > 0 && line[line_length - 1] == '\r')
+        {
+            line[--line_length] = '\0';
+        }
+        if(length != NULL)
+        {
+            *length = line_length;
+        }
+        return line;
+    }
+}
+
+/**
+ * @return The number of lines dropped because they exceeded the maximum size
+ */
+guint tnp_framer_dropped_lines(const TnpFramer* framer)
+{
+    return framer->dropped;
+}
@@ -0,0 +1,45 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_FRAMER_H__
+#define __TNP_FRAMER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS;
+
+/**
+ * Splits the byte stream of the client socket into lines. Data is received
+ * directly into the framer's buffer and lines are terminated and returned in
+ * place, so every byte is scanned once and never shifted per line.
+ */
+typedef struct _TnpFramer TnpFramer;
+
+TnpFramer* tnp_framer_new (gsize initial_size, gsize max_size) G_GNUC_INTERNAL;
+void tnp_framer_free (TnpFramer* framer) G_GNUC_INTERNAL;
+void tnp_framer_reset (TnpFramer* framer) G_GNUC_INTERNAL;
+gchar* tnp_framer_reserve (TnpFramer* framer, gsize* available) G_GNUC_INTERNAL;
+void tnp_framer_commit (TnpFramer* framer, gsize length) G_GNUC_INTERNAL;
+gchar* tnp_framer_next_line (TnpFramer* framer, gsize* length) G_GNUC_INTERNAL;
+guint tnp_framer_dropped_lines (const TnpFramer* framer) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_FRAMER_H__ */
@@ -0,0 +1,609 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include "tnp-menu.h"
+#include "tnp-rtt.h"
+#include "tnp-stats.h"
+
+// bounds of the time to wait for a menu, see tnp-rtt.h
+#define MENU_TIMEOUT_INITIAL (2 * G_USEC_PER_SEC)
+#define MENU_TIMEOUT_MIN (G_USEC_PER_SEC / 2)
+#define MENU_TIMEOUT_MAX (60 * G_USEC_PER_SEC)
+
+typedef struct
+{
+    gchar*       root;
+    // the connection of the client the menu is fetched from
+    guint        connection;
+    // the client's menu or NULL if it has not been received yet
+    GPtrArray*   actions;
+    // argument of the last GET_MENU_ITEMS request, used for refreshing
+    gchar*       request;
+    gboolean     fetching;
+} TnpMenuEntry;
+
+/**
+ * A GET_MENU_ITEMS request waiting for its reply.
+ */
+typedef struct
+{
+    gchar*       key;
+    gint64       sent;
+    // the start time for the statistics, 0 if they are disabled
+    gint64       start;
+    // the menu may be requested again, but the reply is still expected
+    gboolean     expired;
+} TnpMenuRequest;
+
+/**
+ * The requests sent to one client. Replies only arrive in the order of the
+ * requests on the same socket, so they are matched per connection.
+ */
+typedef struct
+{
+    // TnpMenuRequest of the entries whose menus were requested, in the order
+    // the replies will arrive
+    GQueue       pending;
+    // the actions of the reply currently being received
+    GPtrArray*   receiving;
+    // requests written once per main loop iteration, the last "unsent"
+    // requests of "pending" belong to them
+    GString*     outgoing;
+    guint        unsent;
+    // set when a request stayed unanswered for so long that replies can no
+    // longer be matched by their order, until the next request was written
+    gboolean     desynchronized;
+} TnpMenuConnection;
+
+struct _TnpMenuCache
+{
+    // "<kind>:<root>" -> TnpMenuEntry
+    GHashTable*     entries;
+    // connection -> TnpMenuConnection, created on demand
+    GHashTable*     connections;
+    guint           flush_id;
+    // requests that did not time out yet, which the timeout waits for
+    guint           waiting;
+    guint           timeout_id;
+    TnpRtt*         rtt;
+    // how long a request is waited for at most, see tnp_menu_cache_check_order()
+    gint64          max_wait;
+    // changes whenever a menu is received or forgotten
+    guint           generation;
+    TnpMenuSendFunc send_func;
+    gpointer        user_data;
+};
+
+static void tnp_menu_action_free(gpointer data)
+{
+    TnpMenuAction* action = data;
+    g_free(action->command);
+    g_free(action->flags);
+    g_free(action->text);
+    g_slice_free(TnpMenuAction, action);
+}
+
+static void tnp_menu_entry_free(gpointer data)
+{
+    TnpMenuEntry* entry = data;
+    g_free(entry->root);
+    if(entry->actions != NULL)
+    {
+        g_ptr_array_free(entry->actions, TRUE);
+    }
+    g_free(entry->request);
+    g_slice_free(TnpMenuEntry, entry);
+}
+
+static void tnp_menu_request_free(gpointer data)
+{
+    TnpMenuRequest* request = data;
+    g_free(request->key);
+    g_slice_free(TnpMenuRequest, request);
+}
+
+static void tnp_menu_connection_free(gpointer data)
+{
+    TnpMenuConnection* connection = data;
+    g_queue_foreach(&connection->pending, (GFunc) tnp_menu_request_free, NULL);
+    g_queue_clear(&connection->pending);
+    if(connection->receiving != NULL)
+    {
+        g_ptr_array_free(connection->receiving, TRUE);
+    }
+    g_string_free(connection->outgoing, TRUE);
+    g_slice_free(TnpMenuConnection, connection);
+}
+
+static TnpMenuConnection* tnp_menu_cache_get_connection(TnpMenuCache* cache, guint id)
+{
+    TnpMenuConnection* connection = g_hash_table_lookup(cache->connections, GUINT_TO_POINTER(id));
+
+    if(connection == NULL)
+    {
+        connection = g_slice_new0(TnpMenuConnection);
+        g_queue_init(&connection->pending);
+        connection->outgoing = g_string_new(NULL);
+        g_hash_table_insert(cache->connections, GUINT_TO_POINTER(id), connection);
+    }
+    return connection;
+}
+
+static gboolean tnp_menu_cache_timeout(gpointer user_data);
+
+/**
+ * (Re)starts the timeout while requests are waiting for their replies. It is
+ * restarted whenever a reply arrives, so it only fires if the clients made no
+ * progress for that long.
+ */
+static void tnp_menu_cache_update_timeout(TnpMenuCache* cache, gboolean progress)
+{
+    if(cache->timeout_id != 0 && (progress || cache->waiting == 0))
+    {
+        g_source_remove(cache->timeout_id);
+        cache->timeout_id = 0;
+    }
+    if(cache->timeout_id == 0 && cache->waiting > 0)
+    {
+        cache->timeout_id = g_timeout_add(MAX(tnp_rtt_get_timeout(cache->rtt) / 1000, 1),
+                                          tnp_menu_cache_timeout, cache);
+    }
+}
+
+/**
+ * Replies carry no path and are matched to the requests by their order. Once
+ * the oldest request went unanswered for longer than any reply is waited for,
+ * the client may have dropped it or may still answer it, so the order cannot
+ * be trusted anymore: all requests on "connection" are forgotten, their menus
+ * may be requested again, and replies are ignored until a new request was
+ * written.
+ * @return TRUE if the connection is out of order
+ */
+static gboolean tnp_menu_cache_check_order(TnpMenuCache* cache, TnpMenuConnection* connection)
+{
+    TnpMenuRequest* request = g_queue_peek_head(&connection->pending);
+    TnpMenuEntry* entry;
+
+    if(connection->desynchronized)
+    {
+        return TRUE;
+    }
+    if(request == NULL || g_get_monotonic_time() - request->sent <= cache->max_wait)
+    {
+        return FALSE;
+    }
+    #ifdef G_ENABLE_DEBUG
+    g_message("Menu replies out of order, dropping %u requests", g_queue_get_length(&connection->pending));
+    #endif
+    while((request = g_queue_pop_head(&connection->pending)) != NULL)
+    {
+        if(!request->expired)
+        {
+            cache->waiting--;
+        }
+        entry = g_hash_table_lookup(cache->entries, request->key);
+        if(entry != NULL)
+        {
+            entry->fetching = FALSE;
+        }
+        tnp_menu_request_free(request);
+    }
+    if(connection->receiving != NULL)
+    {
+        g_ptr_array_free(connection->receiving, TRUE);
+        connection->receiving = NULL;
+    }
+    g_string_truncate(connection->outgoing, 0);
+    connection->unsent = 0;
+    connection->desynchronized = TRUE;
+    tnp_menu_cache_update_timeout(cache, FALSE);
+    return TRUE;
+}
+
+/**
+ * Gives up on the requests that got no reply within the timeout, so their
+ * menus are requested again by the next lookup. They stay queued, so their
+ * late replies are still matched to them instead of being taken for the
+ * replies of later requests.
+ */
+static gboolean tnp_menu_cache_timeout(gpointer user_data)
+{
+    TnpMenuCache* cache = user_data;
+    TnpMenuRequest* request;
+    TnpMenuEntry* entry;
+    GHashTableIter iter;
+    gpointer value;
+    GList* link;
+    gint64 now = g_get_monotonic_time();
+    gint64 timeout = tnp_rtt_get_timeout(cache->rtt);
+    gboolean expired = FALSE;
+
+    cache->timeout_id = 0;
+    g_hash_table_iter_init(&iter, cache->connections);
+    while(g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        if(tnp_menu_cache_check_order(cache, value))
+        {
+            continue;
+        }
+        for(link = ((TnpMenuConnection*) value)->pending.head; link != NULL; link = link->next)
+        {
+            request = link->data;
+            if(request->expired || now - request->sent < timeout)
+            {
+                continue;
+            }
+            #ifdef G_ENABLE_DEBUG
+            g_message("Menu request timed out: %s", request->key);
+            #endif
+            request->expired = TRUE;
+            cache->waiting--;
+            entry = g_hash_table_lookup(cache->entries, request->key);
+            if(entry != NULL)
+            {
+                entry->fetching = FALSE;
+            }
+            tnp_stats_add(TNP_STATS_MENU_TIMEOUTS, 1);
+            expired = TRUE;
+        }
+    }
+    if(expired)
+    {
+        tnp_rtt_backoff(cache->rtt);
+    }
+    tnp_menu_cache_update_timeout(cache, FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Writes the requests collected since the last main loop iteration in one go
+ * per client, so selecting items in quick succession does not cost a write
+ * each.
+ */
+static gboolean tnp_menu_cache_flush(gpointer user_data)
+{
+    TnpMenuCache* cache = user_data;
+    TnpMenuConnection* connection;
+    TnpMenuRequest* request;
+    TnpMenuEntry* entry;
+    GHashTableIter iter;
+    gpointer id, value;
+
+    cache->flush_id = 0;
+    g_hash_table_iter_init(&iter, cache->connections);
+    while(g_hash_table_iter_next(&iter, &id, &value))
+    {
+        connection = value;
+        if(connection->outgoing->len > 0 &&
+           !cache->send_func(GPOINTER_TO_UINT(id), connection->outgoing->str, connection->outgoing->len, cache->user_data))
+        {
+            // allow the menus to be requested again later
+            for(; connection->unsent > 0; connection->unsent--)
+            {
+                request = g_queue_pop_tail(&connection->pending);
+                entry = g_hash_table_lookup(cache->entries, request->key);
+                if(entry != NULL)
+                {
+                    entry->fetching = FALSE;
+                }
+                cache->waiting--;
+                tnp_menu_request_free(request);
+            }
+        }
+        else if(connection->outgoing->len > 0)
+        {
+            // the replies to come belong to the requests just written
+            connection->desynchronized = FALSE;
+        }
+        g_string_truncate(connection->outgoing, 0);
+        connection->unsent = 0;
+    }
+    tnp_menu_cache_update_timeout(cache, FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Asks the client for the menu of "entry" unless a request is outstanding.
+ */
+static void tnp_menu_cache_fetch(TnpMenuCache* cache, const gchar* key, TnpMenuEntry* entry)
+{
+    TnpMenuConnection* connection;
+    TnpMenuRequest* request;
+
+    if(entry->fetching)
+    {
+        return;
+    }
+    connection = tnp_menu_cache_get_connection(cache, entry->connection);
+    tnp_menu_cache_check_order(cache, connection);
+    g_string_append(connection->outgoing, "GET_MENU_ITEMS:");
+    g_string_append(connection->outgoing, entry->request);
+    g_string_append_c(connection->outgoing, '\n');
+    entry->fetching = TRUE;
+    request = g_slice_new0(TnpMenuRequest);
+    request->key = g_strdup(key);
+    request->sent = g_get_monotonic_time();
+    request->start = tnp_stats_start();
+    g_queue_push_tail(&connection->pending, request);
+    connection->unsent++;
+    cache->waiting++;
+    if(cache->flush_id == 0)
+    {
+        cache->flush_id = g_idle_add(tnp_menu_cache_flush, cache);
+    }
+    tnp_menu_cache_update_timeout(cache, FALSE);
+}
+
+TnpMenuCache* tnp_menu_cache_new(TnpMenuSendFunc send_func, gpointer user_data)
+{
+    TnpMenuCache* cache = g_slice_new0(TnpMenuCache);
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, tnp_menu_entry_free);
+    cache->connections = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, tnp_menu_connection_free);
+    cache->rtt = tnp_rtt_new(MENU_TIMEOUT_INITIAL, MENU_TIMEOUT_MIN, MENU_TIMEOUT_MAX);
+    cache->max_wait = MENU_TIMEOUT_MAX;
+    cache->generation = 1;
+    cache->send_func = send_func;
+    cache->user_data = user_data;
+    return cache;
+}
+
+/**
+ * Changes the bounds of the time to wait for a menu, see tnp_rtt_new(). The
+ * estimate starts over. Requests waiting longer than "max" make their
+ * connection drop its outstanding requests.
+ */
+void tnp_menu_cache_set_timeouts(TnpMenuCache* cache, gint64 initial, gint64 min, gint64 max)
+{
+    tnp_rtt_free(cache->rtt);
+    cache->rtt = tnp_rtt_new(initial, min, max);
+    cache->max_wait = max;
+    tnp_menu_cache_update_timeout(cache, TRUE);
+}
+
+void tnp_menu_cache_free(TnpMenuCache* cache)
+{
+    if(cache == NULL)
+    {
+        return;
+    }
+    if(cache->flush_id != 0)
+    {
+        g_source_remove(cache->flush_id);
+    }
+    if(cache->timeout_id != 0)
+    {
+        g_source_remove(cache->timeout_id);
+    }
+    tnp_rtt_free(cache->rtt);
+    g_hash_table_destroy(cache->connections);
+    g_hash_table_destroy(cache->entries);
+    g_slice_free(TnpMenuCache, cache);
+}
+
+/**
+ * Forgets all menus and outstanding requests.
+ */
+void tnp_menu_cache_clear(TnpMenuCache* cache)
+{
+    g_hash_table_remove_all(cache->entries);
+    g_hash_table_remove_all(cache->connections);
+    cache->waiting = 0;
+    tnp_menu_cache_update_timeout(cache, FALSE);
+    cache->generation++;
+}
+
+/**
+ * Forgets the menus of the client on "connection" and the requests sent to
+ * it, after the connection was lost. A restarted client may offer a different
+ * menu, and requests for the old connection must not reach a new one.
+ */
+void tnp_menu_cache_disconnect(TnpMenuCache* cache, guint connection)
+{
+    TnpMenuConnection* requests = g_hash_table_lookup(cache->connections, GUINT_TO_POINTER(connection));
+    GHashTableIter iter;
+    gpointer value;
+    GList* link;
+
+    g_hash_table_iter_init(&iter, cache->entries);
+    while(g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        if(((TnpMenuEntry*) value)->connection == connection)
+        {
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+    if(requests != NULL)
+    {
+        for(link = requests->pending.head; link != NULL; link = link->next)
+        {
+            if(!((TnpMenuRequest*) link->data)->expired)
+            {
+                cache->waiting--;
+            }
+        }
+        g_hash_table_remove(cache->connections, GUINT_TO_POINTER(connection));
+        tnp_menu_cache_update_timeout(cache, FALSE);
+    }
+    cache->generation++;
+}
+
+/**
+ * Returns a number that changes whenever a menu returned by
+ * tnp_menu_cache_lookup() may have changed, so callers can keep its result.
+ */
+guint tnp_menu_cache_get_generation(const TnpMenuCache* cache)
+{
+    return cache->generation;
+}
+
+/**
+ * Returns the cached menu for selecting "paths" below the sync root "root".
+ * On a miss, the menu is requested for "paths" in the background from the
+ * client on "connection", which should be the one that registered the root.
+ * @return The actions (owned by the cache, valid while its generation is
+ *         unchanged) or NULL if the menu is not known yet
+ */
+const GPtrArray* tnp_menu_cache_lookup(TnpMenuCache* cache,
+                                       const gchar* root,
+                                       guint connection,
+                                       TnpMenuKind kind,
+                                       GPtrArray* paths)
+{
+    TnpMenuEntry* entry;
+    gchar key[PATH_MAX + 16];
+
+    g_snprintf(key, sizeof(key), "%d:%s", kind, root);
+    entry = g_hash_table_lookup(cache->entries, key);
+    if(entry == NULL)
+    {
+        entry = g_slice_new0(TnpMenuEntry);
+        entry->root = g_strdup(root);
+        g_hash_table_insert(cache->entries, g_strdup(key), entry);
+    }
+    if(entry->actions == NULL)
+    {
+        // the last selection is used for refreshing later
+        g_free(entry->request);
+        g_ptr_array_add(paths, NULL);
+        entry->request = g_strjoinv(TNP_MENU_PATH_SEPARATOR, (gchar**) paths->pdata);
+        g_ptr_array_remove_index(paths, paths->len - 1);
+        // another client may have taken over the root
+        if(!entry->fetching)
+        {
+            entry->connection = connection;
+        }
+        tnp_menu_cache_fetch(cache, key, entry);
+    }
+    return entry->actions;
+}
+
+/**
+ * Refreshes the menus of all sync roots containing or below "path" in the
+ * background, e.g. because the client sent "UPDATE_VIEW". Until the new menus
+ * arrive, the old ones are kept.
+ */
+void tnp_menu_cache_invalidate(TnpMenuCache* cache, const gchar* path)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    TnpMenuEntry* entry;
+    gsize root_length, path_length = strlen(path);
+
+    g_hash_table_iter_init(&iter, cache->entries);
+    while(g_hash_table_iter_next(&iter, &key, &value))
+    {
+        entry = value;
+        root_length = strlen(entry->root);
+        // only whole path components count
+        if((g_str_has_prefix(path, entry->root) &&
+            (path[root_length] == '\0' || path[root_length] == '/')) ||
+           (g_str_has_prefix(entry->root, path) && entry->root[path_length] == '/'))
+        {
+            if(entry->request != NULL)
+            {
+                tnp_menu_cache_fetch(cache, key, entry);
+            }
+        }
+    }
+}
+
+/**
+ * Takes the "GET_MENU_ITEMS:BEGIN", "MENU_ITEM:..." and "GET_MENU_ITEMS:END"
+ * messages of a reply received on "connection". Replies arrive in the order
+ * of the requests sent to the same connection.
+ */
+void tnp_menu_cache_handle_message(TnpMenuCache* cache, guint id, const TnpMessage* message)
+{
+    TnpMenuConnection* connection = g_hash_table_lookup(cache->connections, GUINT_TO_POINTER(id));
+    TnpMenuAction* action;
+    TnpMenuEntry* entry = NULL;
+    TnpMenuRequest* request;
+
+    if(connection == NULL || tnp_menu_cache_check_order(cache, connection))
+    {
+        // nothing was asked on this connection, or the reply cannot be matched
+        return;
+    }
+    if(message->type == TNP_MESSAGE_GET_MENU_ITEMS && strcmp(message->args[0], "BEGIN") == 0)
+    {
+        if(connection->receiving != NULL)
+        {
+            g_ptr_array_free(connection->receiving, TRUE);
+        }
+        connection->receiving = g_ptr_array_new_with_free_func(tnp_menu_action_free);
+    }
+    else if(message->type == TNP_MESSAGE_MENU_ITEM && connection->receiving != NULL)
+    {
+        action = g_slice_new(TnpMenuAction);
+        action->command = g_strdup(message->args[0]);
+        action->flags = g_strdup(message->args[1]);
+        action->text = g_strdup(message->args[2]);
+        g_ptr_array_add(connection->receiving, action);
+    }
+    else if(message->type == TNP_MESSAGE_GET_MENU_ITEMS && strcmp(message->args[0], "END") == 0 &&
+            connection->receiving != NULL)
+    {
+        request = g_queue_pop_head(&connection->pending);
+        if(request != NULL)
+        {
+            tnp_stats_record(TNP_STATS_MENU_ROUND_TRIP, request->start);
+            // late replies are measured too, so the timeout adapts to a slower client
+            tnp_rtt_sample(cache->rtt, g_get_monotonic_time() - request->sent);
+            if(request->expired)
+            {
+                tnp_stats_add(TNP_STATS_LATE_REPLIES, 1);
+            }
+            else
+            {
+                cache->waiting--;
+            }
+            tnp_menu_cache_update_timeout(cache, TRUE);
+            entry = g_hash_table_lookup(cache->entries, request->key);
+        }
+        if(entry != NULL)
+        {
+            if(entry->actions != NULL)
+            {
+                g_ptr_array_free(entry->actions, TRUE);
+            }
+            // a late menu is still the client's, but the entry may be
+            // fetched again already
+            entry->actions = connection->receiving;
+            if(!request->expired)
+            {
+                entry->fetching = FALSE;
+            }
+            cache->generation++;
+        }
+        else
+        {
+            // nobody asked for this menu
+            g_ptr_array_free(connection->receiving, TRUE);
+        }
+        connection->receiving = NULL;
+        if(request != NULL)
+        {
+            tnp_menu_request_free(request);
+        }
+    }
+}
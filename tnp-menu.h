@@ -0,0 +1,86 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_MENU_H__
+#define __TNP_MENU_H__
+
+#include <glib.h>
+
+#include "tnp-protocol.h"
+
+G_BEGIN_DECLS;
+
+/**
+ * The context menu offered by the Nextcloud client for a selection, as
+ * received through "GET_MENU_ITEMS". Menus are cached per sync root and kind
+ * of selection, so building a context menu never waits for the client: a miss
+ * starts a fetch in the background and the caller shows its static menu. The
+ * fetches are written once per main loop iteration. A menu the client does not
+ * send in time, see tnp-rtt.h, is requested again by the next lookup.
+ */
+typedef struct _TnpMenuCache TnpMenuCache;
+
+typedef enum
+{
+    TNP_MENU_KIND_FILE,
+    TNP_MENU_KIND_DIRECTORY,
+    // more than one item is selected
+    TNP_MENU_KIND_MULTIPLE,
+} TnpMenuKind;
+
+/**
+ * An item of the client's menu. Activating it sends "<command>:<paths>".
+ */
+typedef struct
+{
+    gchar* command;
+    // "d" if the item is disabled
+    gchar* flags;
+    gchar* text;
+} TnpMenuAction;
+
+/**
+ * Writes "length" bytes of commands to the client on "connection".
+ * @return FALSE if the commands could not be sent
+ */
+typedef gboolean (*TnpMenuSendFunc) (guint connection, const gchar* data, gsize length, gpointer user_data);
+
+// separates the paths of a multi-selection in commands
+#define TNP_MENU_PATH_SEPARATOR "\x1e"
+
+TnpMenuCache* tnp_menu_cache_new (TnpMenuSendFunc send_func, gpointer user_data) G_GNUC_INTERNAL;
+void tnp_menu_cache_set_timeouts (TnpMenuCache* cache, gint64 initial, gint64 min, gint64 max) G_GNUC_INTERNAL;
+void tnp_menu_cache_free (TnpMenuCache* cache) G_GNUC_INTERNAL;
+void tnp_menu_cache_clear (TnpMenuCache* cache) G_GNUC_INTERNAL;
+void tnp_menu_cache_disconnect (TnpMenuCache* cache, guint connection) G_GNUC_INTERNAL;
+guint tnp_menu_cache_get_generation (const TnpMenuCache* cache) G_GNUC_INTERNAL;
+const GPtrArray* tnp_menu_cache_lookup (TnpMenuCache* cache,
+                                        const gchar* root,
+                                        guint connection,
+                                        TnpMenuKind kind,
+                                        GPtrArray* paths) G_GNUC_INTERNAL;
+void tnp_menu_cache_invalidate (TnpMenuCache* cache, const gchar* path) G_GNUC_INTERNAL;
+void tnp_menu_cache_handle_message (TnpMenuCache* cache,
+                                    guint connection,
+                                    const TnpMessage* message) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_MENU_H__ */
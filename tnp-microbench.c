@@ -0,0 +1,253 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Measures the hot paths of the core library in isolation, without sockets,
+ * threads or a main loop doing anything else:
+ *
+ *   framer   splitting received bytes into lines
+ *   parse    parsing a STATUS: line
+ *   index    looking up the sync root of a path
+ *   intern   interning a path that is already known
+ *   update   recording a changed STATUS: in the status cache
+ *   summary  the recursive status of a sync root
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "tnp-core.h"
+
+// settings, see "options" below
+static gint n_roots = 16;
+static gint n_paths = 100000;
+static gint n_rounds = 10;
+
+static GOptionEntry options[] =
+{
+    { "roots", 'r', 0, G_OPTION_ARG_INT, &n_roots, "Number of sync roots", "N" },
+    { "paths", 'p', 0, G_OPTION_ARG_INT, &n_paths, "Number of distinct paths", "N" },
+    { "rounds", 'n', 0, G_OPTION_ARG_INT, &n_rounds, "Number of times each path is handled", "N" },
+    { NULL }
+};
+
+// keeps results alive, so the compiler cannot drop the measured calls
+static volatile guintptr sink;
+
+static gint64 now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Prints the mean cost of "ops" operations taking "total" nanoseconds.
+ */
+static void report(const gchar* name, guint64 ops, gint64 total)
+{
+    printf("%-8s n=%-9" G_GUINT64_FORMAT " %9.1f ns/op %12.0f op/s\n", name, ops,
+           ops > 0 ? (gdouble) total / ops : 0.0, total > 0 ? ops * 1e9 / total : 0.0);
+}
+
+static gboolean micro_send(const gchar* data, gsize length, gpointer user_data)
+{
+    return TRUE;
+}
+
+static void bench_framer(const GString* stream)
+{
+    TnpFramer* framer = tnp_framer_new(4096, 65536);
+    guint64 lines = 0;
+    gsize offset, length, available;
+    gchar* buffer;
+    gchar* line;
+    gint64 start;
+    gint round;
+
+    start = now_ns();
+    for(round = 0; round < n_rounds; round++)
+    {
+        // in chunks like a socket returns them
+        for(offset = 0; offset < stream->len; offset += length)
+        {
+            buffer = tnp_framer_reserve(framer, &available);
+            length = MIN(available, MIN(stream->len - offset, 4096));
+            memcpy(buffer, stream->str + offset, length);
+            tnp_framer_commit(framer, length);
+            while((line = tnp_framer_next_line(framer, NULL)) != NULL)
+            {
+                lines++;
+            }
+        }
+    }
+    report("framer", lines, now_ns() - start);
+    tnp_framer_free(framer);
+}
+
+static void bench_parse(gchar** lines)
+{
+    TnpMessage message;
+    gchar** copies;
+    gint64 start, total = 0;
+    gint i, round;
+
+    for(round = 0; round < n_rounds; round++)
+    {
+        // parsing works in place, so copy the lines outside the measurement
+        copies = g_strdupv(lines);
+        start = now_ns();
+        for(i = 0; i < n_paths; i++)
+        {
+            sink += tnp_message_parse(copies[i], &message);
+        }
+        total += now_ns() - start;
+        g_strfreev(copies);
+    }
+    report("parse", (guint64) n_rounds * n_paths, total);
+}
+
+static void bench_index(const TnpPathIndex* index, gchar** paths)
+{
+    gint64 start;
+    gint i, round;
+
+    start = now_ns();
+    for(round = 0; round < n_rounds; round++)
+    {
+        for(i = 0; i < n_paths; i++)
+        {
+            sink += (guintptr) tnp_path_index_lookup(index, paths[i]);
+        }
+    }
+    report("index", (guint64) n_rounds * n_paths, now_ns() - start);
+}
+
+static void bench_intern(TnpPathArena* arena, gchar** paths)
+{
+    gint64 start;
+    gint i, round;
+
+    for(i = 0; i < n_paths; i++)
+    {
+        tnp_path_arena_intern(arena, paths[i]);
+    }
+    start = now_ns();
+    for(round = 0; round < n_rounds; round++)
+    {
+        for(i = 0; i < n_paths; i++)
+        {
+            sink += tnp_path_arena_lookup(arena, paths[i]);
+        }
+    }
+    report("intern", (guint64) n_rounds * n_paths, now_ns() - start);
+    for(i = 0; i < n_paths; i++)
+    {
+        tnp_path_arena_unref(arena, tnp_path_arena_lookup(arena, paths[i]));
+    }
+}
+
+static void bench_status(TnpStatusCache* cache, gchar** paths, gchar** roots)
+{
+    static const gchar* statuses[] = { "SYNC", "OK", "ERROR", "OK+SWM" };
+    gint64 start;
+    gint i, round;
+
+    start = now_ns();
+    for(round = 0; round < n_rounds; round++)
+    {
+        for(i = 0; i < n_paths; i++)
+        {
+            tnp_status_cache_update(cache, statuses[(i + round) % G_N_ELEMENTS(statuses)], paths[i]);
+        }
+    }
+    report("update", (guint64) n_rounds * n_paths, now_ns() - start);
+
+    start = now_ns();
+    for(round = 0; round < n_rounds; round++)
+    {
+        for(i = 0; i < n_paths; i++)
+        {
+            sink += tnp_status_cache_get_recursive(cache, roots[i % n_roots]);
+        }
+    }
+    report("summary", (guint64) n_rounds * n_paths, now_ns() - start);
+}
+
+int main(int argc, char** argv)
+{
+    GOptionContext* context;
+    GError* error = NULL;
+    TnpPathIndex* index;
+    TnpPathArena* arena;
+    TnpStatusCache* cache;
+    GString* stream;
+    gchar** roots;
+    gchar** paths;
+    gchar** lines;
+    gint i;
+
+    context = g_option_context_new("- measure the hot paths of the thunar nextcloud plugin's core");
+    g_option_context_add_main_entries(context, options, NULL);
+    if(!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+    g_option_context_free(context);
+    n_roots = MAX(n_roots, 1);
+    n_paths = MAX(n_paths, 1);
+    n_rounds = MAX(n_rounds, 1);
+
+    index = tnp_path_index_new();
+    roots = g_new0(gchar*, n_roots + 1);
+    for(i = 0; i < n_roots; i++)
+    {
+        roots[i] = g_strdup_printf("/home/user/Nextcloud%d", i);
+        tnp_path_index_insert(index, roots[i], 0);
+    }
+    paths = g_new0(gchar*, n_paths + 1);
+    lines = g_new0(gchar*, n_paths + 1);
+    stream = g_string_new(NULL);
+    for(i = 0; i < n_paths; i++)
+    {
+        paths[i] = g_strdup_printf("%s/dir%d/file%d", roots[i % n_roots], i % 100, i);
+        lines[i] = g_strdup_printf("STATUS:SYNC:%s", paths[i]);
+        g_string_append_printf(stream, "%s\n", lines[i]);
+    }
+
+    bench_framer(stream);
+    bench_parse(lines);
+    bench_index(index, paths);
+    arena = tnp_path_arena_new();
+    bench_intern(arena, paths);
+    cache = tnp_status_cache_new(arena, micro_send, NULL, NULL);
+    bench_status(cache, paths, roots);
+
+    tnp_status_cache_free(cache);
+    tnp_path_arena_free(arena);
+    tnp_path_index_free(index);
+    g_string_free(stream, TRUE);
+    g_strfreev(lines);
+    g_strfreev(paths);
+    g_strfreev(roots);
+    return 0;
+}
@@ -0,0 +1,237 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "tnp-path-arena.h"
+
+// paths are appended to chunks of this size, longer ones are stored separately
+#define CHUNK_SIZE 16384
+// compact once released paths take up more space than this and than the live ones
+#define COMPACT_THRESHOLD CHUNK_SIZE
+
+typedef struct
+{
+    // NULL if the slot is free
+    const gchar* path;
+    guint        refs;
+    // next free slot + 1, if this one is free
+    guint        next_free;
+} TnpPathSlot;
+
+struct _TnpPathArena
+{
+    // path (pointing into a chunk) -> handle
+    GHashTable* handles;
+    // handle - 1 -> TnpPathSlot
+    GArray*     slots;
+    guint       first_free;
+    // gchar* chunks, the last one is being filled
+    GPtrArray*  chunks;
+    gsize       chunk_used;
+    // gchar* copies of the paths that do not fit into a chunk
+    GPtrArray*  oversize;
+    gsize       live_bytes;
+    gsize       dead_bytes;
+    guint       compact_id;
+};
+
+#define SLOT(arena, handle) (&g_array_index((arena)->slots, TnpPathSlot, (handle) - 1))
+
+/**
+ * Copies "length" bytes of "path" and its terminator into the chunks.
+ */
+static const gchar* tnp_path_arena_store(TnpPathArena* arena, const gchar* path, gsize length)
+{
+    gchar* chunk;
+    gchar* copy;
+
+    if(length + 1 > CHUNK_SIZE)
+    {
+        // kept apart, so they never become the chunk being filled
+        copy = g_strndup(path, length);
+        g_ptr_array_add(arena->oversize, copy);
+        return copy;
+    }
+    if(arena->chunks->len == 0 || arena->chunk_used + length + 1 > CHUNK_SIZE)
+    {
+        g_ptr_array_add(arena->chunks, g_malloc(CHUNK_SIZE));
+        arena->chunk_used = 0;
+    }
+    chunk = g_ptr_array_index(arena->chunks, arena->chunks->len - 1);
+    copy = chunk + arena->chunk_used;
+    memcpy(copy, path, length + 1);
+    arena->chunk_used += length + 1;
+    return copy;
+}
+
+/**
+ * Moves all live paths into fresh chunks and releases the old ones.
+ */
+static gboolean tnp_path_arena_compact(gpointer user_data)
+{
+    TnpPathArena* arena = user_data;
+    GPtrArray* old_chunks = arena->chunks;
+    GPtrArray* old_oversize = arena->oversize;
+    TnpPathSlot* slot;
+    guint i;
+
+    arena->compact_id = 0;
+    arena->chunks = g_ptr_array_new_with_free_func(g_free);
+    arena->oversize = g_ptr_array_new_with_free_func(g_free);
+    arena->chunk_used = 0;
+    g_hash_table_remove_all(arena->handles);
+    for(i = 0; i < arena->slots->len; i++)
+    {
+        slot = &g_array_index(arena->slots, TnpPathSlot, i);
+        if(slot->path != NULL)
+        {
+            slot->path = tnp_path_arena_store(arena, slot->path, strlen(slot->path));
+            g_hash_table_insert(arena->handles, (gpointer) slot->path, TNP_PATH_HANDLE_TO_POINTER(i + 1));
+        }
+    }
+    g_ptr_array_free(old_chunks, TRUE);
+    g_ptr_array_free(old_oversize, TRUE);
+    arena->dead_bytes = 0;
+    #ifdef G_ENABLE_DEBUG
+    g_message("Compacted path arena to %" G_GSIZE_FORMAT " bytes", arena->live_bytes);
+    #endif
+    return G_SOURCE_REMOVE;
+}
+
+TnpPathArena* tnp_path_arena_new()
+{
+    TnpPathArena* arena = g_slice_new0(TnpPathArena);
+    arena->handles = g_hash_table_new(g_str_hash, g_str_equal);
+    arena->slots = g_array_new(FALSE, FALSE, sizeof(TnpPathSlot));
+    arena->chunks = g_ptr_array_new_with_free_func(g_free);
+    arena->oversize = g_ptr_array_new_with_free_func(g_free);
+    return arena;
+}
+
+void tnp_path_arena_free(TnpPathArena* arena)
+{
+    if(arena == NULL)
+    {
+        return;
+    }
+    if(arena->compact_id != 0)
+    {
+        g_source_remove(arena->compact_id);
+    }
+    g_hash_table_destroy(arena->handles);
+    g_array_free(arena->slots, TRUE);
+    g_ptr_array_free(arena->chunks, TRUE);
+    g_ptr_array_free(arena->oversize, TRUE);
+    g_slice_free(TnpPathArena, arena);
+}
+
+/**
+ * Returns the handle of "path", storing the path if it is new.
+ * @return A handle holding a new reference
+ */
+TnpPathHandle tnp_path_arena_intern(TnpPathArena* arena, const gchar* path)
+{
+    TnpPathHandle handle = tnp_path_arena_lookup(arena, path);
+    TnpPathSlot* slot;
+    TnpPathSlot empty = { NULL, 0, 0 };
+    gsize length;
+
+    if(handle != TNP_PATH_HANDLE_NONE)
+    {
+        return tnp_path_arena_ref(arena, handle);
+    }
+    // reuse a released slot if there is one
+    if(arena->first_free != 0)
+    {
+        handle = arena->first_free;
+        arena->first_free = SLOT(arena, handle)->next_free;
+    }
+    else
+    {
+        g_array_append_val(arena->slots, empty);
+        handle = arena->slots->len;
+    }
+    length = strlen(path);
+    slot = SLOT(arena, handle);
+    slot->path = tnp_path_arena_store(arena, path, length);
+    slot->refs = 1;
+    slot->next_free = 0;
+    arena->live_bytes += length + 1;
+    g_hash_table_insert(arena->handles, (gpointer) slot->path, TNP_PATH_HANDLE_TO_POINTER(handle));
+    return handle;
+}
+
+/**
+ * Returns the handle of "path" without taking a reference.
+ * @return The handle or TNP_PATH_HANDLE_NONE if the path is not interned
+ */
+TnpPathHandle tnp_path_arena_lookup(TnpPathArena* arena, const gchar* path)
+{
+    return TNP_POINTER_TO_PATH_HANDLE(g_hash_table_lookup(arena->handles, path));
+}
+
+TnpPathHandle tnp_path_arena_ref(TnpPathArena* arena, TnpPathHandle handle)
+{
+    SLOT(arena, handle)->refs++;
+    return handle;
+}
+
+/**
+ * Drops a reference to "handle". The handle becomes invalid with the last one.
+ */
+void tnp_path_arena_unref(TnpPathArena* arena, TnpPathHandle handle)
+{
+    TnpPathSlot* slot = SLOT(arena, handle);
+    gsize length;
+
+    if(--slot->refs > 0)
+    {
+        return;
+    }
+    g_hash_table_remove(arena->handles, slot->path);
+    length = strlen(slot->path) + 1;
+    arena->live_bytes -= length;
+    arena->dead_bytes += length;
+    slot->path = NULL;
+    slot->next_free = arena->first_free;
+    arena->first_free = handle;
+    // strings may still be in use by the caller, so never compact right away
+    if(arena->compact_id == 0 && arena->dead_bytes > COMPACT_THRESHOLD && arena->dead_bytes > arena->live_bytes)
+    {
+        arena->compact_id = g_idle_add(tnp_path_arena_compact, arena);
+    }
+}
+
+/**
+ * @return The path of "handle", owned by the arena
+ */
+const gchar* tnp_path_arena_get(const TnpPathArena* arena, TnpPathHandle handle)
+{
+    return g_array_index(arena->slots, TnpPathSlot, handle - 1).path;
+}
+
+/**
+ * @return The number of interned paths
+ */
+guint tnp_path_arena_size(const TnpPathArena* arena)
+{
+    return g_hash_table_size(arena->handles);
+}
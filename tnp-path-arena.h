@@ -0,0 +1,59 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_PATH_ARENA_H__
+#define __TNP_PATH_ARENA_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS;
+
+/**
+ * Interns canonical paths: every path is stored once, packed into large
+ * chunks, and referred to by a 32 bit handle that can be used directly as a
+ * hash table key (see TNP_PATH_HANDLE_TO_POINTER). Handles are reference
+ * counted; the space of released paths is reclaimed by compacting the chunks
+ * from an idle callback.
+ *
+ * Thread-safety: main context only. Strings returned by tnp_path_arena_get()
+ * stay valid until control returns to the main loop.
+ */
+typedef struct _TnpPathArena TnpPathArena;
+
+typedef guint32 TnpPathHandle;
+
+// never returned for a valid path
+#define TNP_PATH_HANDLE_NONE 0
+
+#define TNP_PATH_HANDLE_TO_POINTER(h) GUINT_TO_POINTER(h)
+#define TNP_POINTER_TO_PATH_HANDLE(p) ((TnpPathHandle) GPOINTER_TO_UINT(p))
+
+TnpPathArena* tnp_path_arena_new (void) G_GNUC_INTERNAL;
+void tnp_path_arena_free (TnpPathArena* arena) G_GNUC_INTERNAL;
+TnpPathHandle tnp_path_arena_intern (TnpPathArena* arena, const gchar* path) G_GNUC_INTERNAL;
+TnpPathHandle tnp_path_arena_lookup (TnpPathArena* arena, const gchar* path) G_GNUC_INTERNAL;
+TnpPathHandle tnp_path_arena_ref (TnpPathArena* arena, TnpPathHandle handle) G_GNUC_INTERNAL;
+void tnp_path_arena_unref (TnpPathArena* arena, TnpPathHandle handle) G_GNUC_INTERNAL;
+const gchar* tnp_path_arena_get (const TnpPathArena* arena, TnpPathHandle handle) G_GNUC_INTERNAL;
+guint tnp_path_arena_size (const TnpPathArena* arena) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_PATH_ARENA_H__ */
@@ -0,0 +1,223 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include "tnp-path-cache.h"
+#include "tnp-stats.h"
+
+typedef struct _TnpPathCacheEntry TnpPathCacheEntry;
+
+struct _TnpPathCacheEntry
+{
+    TnpPathCache* cache;
+    gchar*        uri;
+    TnpPathHandle canonical;
+    // sync root containing the directory, valid while generation matches
+    const gchar*  root;
+    guint         generation;
+    gboolean      root_valid;
+    GFile*        file;
+    GFileMonitor* monitor;
+    // position in the LRU list, data points back to the entry
+    GList         link;
+};
+
+struct _TnpPathCache
+{
+    // uri -> TnpPathCacheEntry
+    GHashTable*   entries;
+    // holds the canonical paths, shared with the other caches
+    TnpPathArena* arena;
+    // most recently used entry first
+    GQueue        lru;
+    guint         capacity;
+    // changes whenever a directory is dropped and no longer watched
+    guint         generation;
+};
+
+static void tnp_path_cache_entry_free(gpointer data)
+{
+    TnpPathCacheEntry* entry = data;
+
+    g_queue_unlink(&entry->cache->lru, &entry->link);
+    if(entry->monitor != NULL)
+    {
+        g_signal_handlers_disconnect_matched(entry->monitor, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, entry);
+        g_file_monitor_cancel(entry->monitor);
+        g_object_unref(entry->monitor);
+    }
+    g_object_unref(entry->file);
+    g_free(entry->uri);
+    tnp_path_arena_unref(entry->cache->arena, entry->canonical);
+    g_slice_free(TnpPathCacheEntry, entry);
+}
+
+/**
+ * Drops a cached directory once it no longer exists under its URI. Changes to
+ * its children do not affect the canonical path and are ignored.
+ */
+static void tnp_path_cache_monitor_changed(GFileMonitor* monitor,
+                                           GFile* file,
+                                           GFile* other_file,
+                                           GFileMonitorEvent event,
+                                           gpointer user_data)
+{
+    TnpPathCacheEntry* entry = user_data;
+
+    switch(event)
+    {
+        case G_FILE_MONITOR_EVENT_PRE_UNMOUNT:
+        case G_FILE_MONITOR_EVENT_UNMOUNTED:
+            break;
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_MOVED:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+        case G_FILE_MONITOR_EVENT_RENAMED:
+            if(!g_file_equal(file, entry->file))
+            {
+                return;
+            }
+            break;
+        default:
+            return;
+    }
+    #ifdef G_ENABLE_DEBUG
+    g_message("Invalidating cached path: %s", tnp_path_arena_get(entry->cache->arena, entry->canonical));
+    #endif
+    entry->cache->generation++;
+    g_hash_table_remove(entry->cache->entries, entry->uri);
+}
+
+/**
+ * Creates a cache holding up to "capacity" directories, interning their
+ * canonical paths in "arena". Every cached directory is watched by a
+ * GFileMonitor, so the capacity should be small.
+ */
+TnpPathCache* tnp_path_cache_new(guint capacity, TnpPathArena* arena)
+{
+    TnpPathCache* cache = g_slice_new0(TnpPathCache);
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, tnp_path_cache_entry_free);
+    cache->arena = arena;
+    g_queue_init(&cache->lru);
+    cache->capacity = MAX(capacity, 1);
+    cache->generation = 1;
+    return cache;
+}
+
+void tnp_path_cache_free(TnpPathCache* cache)
+{
+    if(cache == NULL)
+    {
+        return;
+    }
+    g_hash_table_destroy(cache->entries);
+    g_slice_free(TnpPathCache, cache);
+}
+
+void tnp_path_cache_clear(TnpPathCache* cache)
+{
+    g_hash_table_remove_all(cache->entries);
+    cache->generation++;
+}
+
+/**
+ * Returns a number that changes whenever a directory is dropped from the
+ * cache, so a resolution done before can be kept while it is unchanged: until
+ * then the directory is still watched for being moved or deleted.
+ */
+guint tnp_path_cache_get_generation(const TnpPathCache* cache)
+{
+    return cache->generation;
+}
+
+/**
+ * Resolves the directory "uri" and determines the sync root containing it.
+ * Cache hits need no system calls; the sync root is looked up again only if
+ * "index" changed since the last lookup.
+ * @param root Set to the sync root (owned by "index") or NULL if not synced
+ * @return The canonical path (owned by the arena, valid until the next call)
+ *         or NULL if the URI is not local or cannot be resolved
+ */
+const gchar* tnp_path_cache_lookup(TnpPathCache* cache,
+                                   const gchar* uri,
+                                   const TnpPathIndex* index,
+                                   const gchar** root)
+{
+    TnpPathCacheEntry* entry;
+    gchar* filename;
+    char realpath_buffer[PATH_MAX];
+    gint64 start;
+    gboolean resolved;
+
+    *root = NULL;
+    entry = g_hash_table_lookup(cache->entries, uri);
+    if(entry != NULL)
+    {
+        // move to the front of the LRU list
+        g_queue_unlink(&cache->lru, &entry->link);
+        g_queue_push_head_link(&cache->lru, &entry->link);
+    }
+    else
+    {
+        filename = g_filename_from_uri(uri, NULL, NULL);
+        start = tnp_stats_start();
+        resolved = filename != NULL && realpath(filename, realpath_buffer) != NULL;
+        tnp_stats_record(TNP_STATS_REALPATH, start);
+        if(!resolved)
+        {
+            #ifdef G_ENABLE_DEBUG
+            g_message("Failed to resolve path: %s", uri);
+            #endif
+            g_free(filename);
+            return NULL;
+        }
+        g_free(filename);
+
+        entry = g_slice_new0(TnpPathCacheEntry);
+        entry->cache = cache;
+        entry->uri = g_strdup(uri);
+        entry->canonical = tnp_path_arena_intern(cache->arena, realpath_buffer);
+        entry->file = g_file_new_for_uri(uri);
+        entry->link.data = entry;
+        entry->monitor = g_file_monitor_directory(entry->file, G_FILE_MONITOR_WATCH_MOUNTS, NULL, NULL);
+        if(entry->monitor != NULL)
+        {
+            g_signal_connect(entry->monitor, "changed", G_CALLBACK(tnp_path_cache_monitor_changed), entry);
+        }
+        g_queue_push_head_link(&cache->lru, &entry->link);
+        g_hash_table_insert(cache->entries, entry->uri, entry);
+        // evict the least recently used directory
+        if(g_hash_table_size(cache->entries) > cache->capacity)
+        {
+            cache->generation++;
+            g_hash_table_remove(cache->entries, ((TnpPathCacheEntry*) cache->lru.tail->data)->uri);
+        }
+    }
+    if(!entry->root_valid || entry->generation != tnp_path_index_generation(index))
+    {
+        entry->root = tnp_path_index_lookup(index, tnp_path_arena_get(cache->arena, entry->canonical));
+        entry->generation = tnp_path_index_generation(index);
+        entry->root_valid = TRUE;
+    }
+    *root = entry->root;
+    return tnp_path_arena_get(cache->arena, entry->canonical);
+}
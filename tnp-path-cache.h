@@ -0,0 +1,49 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_PATH_CACHE_H__
+#define __TNP_PATH_CACHE_H__
+
+#include <gio/gio.h>
+
+#include "tnp-path-arena.h"
+#include "tnp-path-index.h"
+
+G_BEGIN_DECLS;
+
+/**
+ * A bounded LRU cache from directory URIs to their canonical path and the
+ * sync root containing it. Entries are dropped when a GFileMonitor reports
+ * that the directory was deleted, moved or unmounted.
+ */
+typedef struct _TnpPathCache TnpPathCache;
+
+TnpPathCache* tnp_path_cache_new (guint capacity, TnpPathArena* arena) G_GNUC_INTERNAL;
+void tnp_path_cache_free (TnpPathCache* cache) G_GNUC_INTERNAL;
+void tnp_path_cache_clear (TnpPathCache* cache) G_GNUC_INTERNAL;
+guint tnp_path_cache_get_generation (const TnpPathCache* cache) G_GNUC_INTERNAL;
+const gchar* tnp_path_cache_lookup (TnpPathCache* cache,
+                                    const gchar* uri,
+                                    const TnpPathIndex* index,
+                                    const gchar** root) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_PATH_CACHE_H__ */
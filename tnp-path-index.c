@@ -0,0 +1,512 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include "tnp-path-index.h"
+
+typedef struct _TnpPathNode TnpPathNode;
+
+struct _TnpPathNode
+{
+    // component name -> TnpPathNode, created on demand
+    GHashTable* children;
+    // full path if this node is a sync root, NULL otherwise
+    gchar*      root;
+    // the caller-defined owner of the root, e.g. the connection that registered it
+    guint       owner;
+    // guint owners that registered the same root later, in order, or NULL;
+    // they take over when the owner unregisters it
+    GArray*     owners;
+};
+
+struct _TnpPathIndex
+{
+    TnpPathNode* top;
+    guint        size;
+    // changed on every modification so lookups can be cached by callers
+    guint        generation;
+};
+
+// generations are unique across all indexes, so a cached lookup can never be
+// mistaken as valid for a different index (or a copy)
+static gint last_generation = 0;
+
+static guint next_generation()
+{
+    return g_atomic_int_add(&last_generation, 1) + 1;
+}
+
+static TnpPathNode* tnp_path_node_new()
+{
+    return g_slice_new0(TnpPathNode);
+}
+
+static void tnp_path_node_free(gpointer data)
+{
+    TnpPathNode* node = data;
+    if(node->children != NULL)
+    {
+        g_hash_table_destroy(node->children);
+    }
+    if(node->owners != NULL)
+    {
+        g_array_free(node->owners, TRUE);
+    }
+    g_free(node->root);
+    g_slice_free(TnpPathNode, node);
+}
+
+static gboolean tnp_path_node_is_empty(const TnpPathNode* node)
+{
+    return node->root == NULL && (node->children == NULL || g_hash_table_size(node->children) == 0);
+}
+
+static gboolean tnp_path_node_has_owner(const TnpPathNode* node, guint owner)
+{
+    guint i;
+
+    if(node->owner == owner)
+    {
+        return TRUE;
+    }
+    for(i = 0; node->owners != NULL && i < node->owners->len; i++)
+    {
+        if(g_array_index(node->owners, guint, i) == owner)
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * Drops "owner" from the owners of the root of "node". If it was the current
+ * owner, the next one takes over; the root is removed with its last owner.
+ * @return TRUE if the root or its current owner changed
+ */
+static gboolean tnp_path_node_drop_owner(TnpPathNode* node, guint owner)
+{
+    guint i;
+
+    if(node->root == NULL)
+    {
+        return FALSE;
+    }
+    if(node->owner != owner)
+    {
+        for(i = 0; node->owners != NULL && i < node->owners->len; i++)
+        {
+            if(g_array_index(node->owners, guint, i) == owner)
+            {
+                g_array_remove_index(node->owners, i);
+                break;
+            }
+        }
+        return FALSE;
+    }
+    if(node->owners != NULL && node->owners->len > 0)
+    {
+        node->owner = g_array_index(node->owners, guint, 0);
+        g_array_remove_index(node->owners, 0);
+    }
+    else
+    {
+        g_free(node->root);
+        node->root = NULL;
+    }
+    return TRUE;
+}
+
+/**
+ * Returns the next path component of "*cursor" and advances the cursor past
+ * it. Components are terminated in place, so the buffer is modified. Empty
+ * components (caused by leading or repeated slashes) are skipped.
+ * @return The component or NULL if there are no components left
+ */
+static gchar* next_component(gchar** cursor)
+{
+    gchar* start = *cursor;
+    gchar* end;
+
+    while(*start == '/')
+    {
+        start++;
+    }
+    if(*start == '\0')
+    {
+        *cursor = start;
+        return NULL;
+    }
+    end = strchr(start, '/');
+    if(end == NULL)
+    {
+        *cursor = start + strlen(start);
+    }
+    else
+    {
+        *end = '\0';
+        *cursor = end + 1;
+    }
+    return start;
+}
+
+/**
+ * Copies "path" into "buffer" so it can be split into components.
+ * @return FALSE if the path is not absolute or too long
+ */
+static gboolean copy_path(gchar buffer[PATH_MAX], const gchar* path)
+{
+    if(path == NULL || path[0] != '/' || g_strlcpy(buffer, path, PATH_MAX) >= PATH_MAX)
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+TnpPathIndex* tnp_path_index_new()
+{
+    TnpPathIndex* index = g_slice_new0(TnpPathIndex);
+    index->top = tnp_path_node_new();
+    index->generation = next_generation();
+    return index;
+}
+
+static TnpPathNode* tnp_path_node_copy(const TnpPathNode* node)
+{
+    TnpPathNode* copy = tnp_path_node_new();
+    GHashTableIter iter;
+    gpointer key, child;
+
+    copy->root = g_strdup(node->root);
+    copy->owner = node->owner;
+    if(node->owners != NULL)
+    {
+        copy->owners = g_array_sized_new(FALSE, FALSE, sizeof(guint), node->owners->len);
+        g_array_append_vals(copy->owners, node->owners->data, node->owners->len);
+    }
+    if(node->children != NULL)
+    {
+        copy->children = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, tnp_path_node_free);
+        g_hash_table_iter_init(&iter, node->children);
+        while(g_hash_table_iter_next(&iter, &key, &child))
+        {
+            g_hash_table_insert(copy->children, g_strdup(key), tnp_path_node_copy(child));
+        }
+    }
+    return copy;
+}
+
+/**
+ * Creates a deep copy of "index" that shares no memory with it, so it can be
+ * handed to another thread.
+ */
+TnpPathIndex* tnp_path_index_copy(const TnpPathIndex* index)
+{
+    TnpPathIndex* copy = g_slice_new0(TnpPathIndex);
+    copy->top = tnp_path_node_copy(index->top);
+    copy->size = index->size;
+    copy->generation = next_generation();
+    return copy;
+}
+
+void tnp_path_index_free(TnpPathIndex* index)
+{
+    if(index == NULL)
+    {
+        return;
+    }
+    tnp_path_node_free(index->top);
+    g_slice_free(TnpPathIndex, index);
+}
+
+/**
+ * Removes all sync roots from the index.
+ */
+void tnp_path_index_clear(TnpPathIndex* index)
+{
+    tnp_path_node_free(index->top);
+    index->top = tnp_path_node_new();
+    index->size = 0;
+    index->generation = next_generation();
+}
+
+/**
+ * Registers "path" as a sync root belonging to "owner". The path has to be
+ * absolute and should already be canonical (see realpath(3)). If another owner
+ * registered it before, that one keeps it and "owner" takes over once it is
+ * gone, see tnp_path_index_remove().
+ * @return TRUE if the root was added, FALSE if it was invalid or already known
+ */
+gboolean tnp_path_index_insert(TnpPathIndex* index, const gchar* path, guint owner)
+{
+    gchar buffer[PATH_MAX];
+    gchar* cursor = buffer;
+    gchar* component;
+    TnpPathNode* node = index->top;
+    TnpPathNode* child;
+
+    if(!copy_path(buffer, path))
+    {
+        return FALSE;
+    }
+    for(component = next_component(&cursor); component != NULL; component = next_component(&cursor))
+    {
+        if(node->children == NULL)
+        {
+            node->children = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, tnp_path_node_free);
+        }
+        child = g_hash_table_lookup(node->children, component);
+        if(child == NULL)
+        {
+            child = tnp_path_node_new();
+            g_hash_table_insert(node->children, g_strdup(component), child);
+        }
+        node = child;
+    }
+    if(node->root != NULL)
+    {
+        if(!tnp_path_node_has_owner(node, owner))
+        {
+            if(node->owners == NULL)
+            {
+                node->owners = g_array_new(FALSE, FALSE, sizeof(guint));
+            }
+            g_array_append_val(node->owners, owner);
+        }
+        return FALSE;
+    }
+    node->root = g_strdup(path);
+    node->owner = owner;
+    index->size++;
+    index->generation = next_generation();
+    return TRUE;
+}
+
+/**
+ * Unregisters the sync root "path" for "owner" and prunes nodes that became
+ * unused. Other owners that registered the same root keep it.
+ * @return TRUE if the root has been removed or handed to another owner
+ */
+gboolean tnp_path_index_remove(TnpPathIndex* index, const gchar* path, guint owner)
+{
+    gchar buffer[PATH_MAX];
+    gchar* cursor = buffer;
+    gchar* component;
+    TnpPathNode* node = index->top;
+    GPtrArray* trail;
+    GPtrArray* keys;
+    guint i;
+
+    if(!copy_path(buffer, path))
+    {
+        return FALSE;
+    }
+    // remember the way down so empty nodes can be pruned on the way up
+    trail = g_ptr_array_new();
+    keys = g_ptr_array_new();
+    for(component = next_component(&cursor); component != NULL; component = next_component(&cursor))
+    {
+        g_ptr_array_add(trail, node);
+        g_ptr_array_add(keys, component);
+        node = node->children == NULL ? NULL : g_hash_table_lookup(node->children, component);
+        if(node == NULL)
+        {
+            break;
+        }
+    }
+    if(node == NULL || !tnp_path_node_drop_owner(node, owner))
+    {
+        g_ptr_array_free(trail, TRUE);
+        g_ptr_array_free(keys, TRUE);
+        return FALSE;
+    }
+    index->generation = next_generation();
+    if(node->root != NULL)
+    {
+        // another owner took over
+        g_ptr_array_free(trail, TRUE);
+        g_ptr_array_free(keys, TRUE);
+        return TRUE;
+    }
+    index->size--;
+    for(i = trail->len; i > 0 && tnp_path_node_is_empty(node); i--)
+    {
+        node = g_ptr_array_index(trail, i - 1);
+        g_hash_table_remove(node->children, g_ptr_array_index(keys, i - 1));
+    }
+    g_ptr_array_free(trail, TRUE);
+    g_ptr_array_free(keys, TRUE);
+    return TRUE;
+}
+
+/**
+ * Drops "owner" from all sync roots of "node" and its children.
+ * @param removed Incremented for every root removed with its last owner
+ * @return The number of roots removed or handed to another owner
+ */
+static guint tnp_path_node_remove_owner(TnpPathNode* node, guint owner, guint* removed)
+{
+    GHashTableIter iter;
+    gpointer child;
+    guint changed = 0;
+
+    if(tnp_path_node_drop_owner(node, owner))
+    {
+        changed++;
+        if(node->root == NULL)
+        {
+            (*removed)++;
+        }
+    }
+    if(node->children != NULL)
+    {
+        g_hash_table_iter_init(&iter, node->children);
+        while(g_hash_table_iter_next(&iter, NULL, &child))
+        {
+            changed += tnp_path_node_remove_owner(child, owner, removed);
+            if(tnp_path_node_is_empty(child))
+            {
+                g_hash_table_iter_remove(&iter);
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+ * Unregisters all sync roots of "owner", e.g. because its client went away.
+ * Roots that other owners registered as well are handed to them.
+ * @return The number of roots removed or handed to another owner
+ */
+guint tnp_path_index_remove_owner(TnpPathIndex* index, guint owner)
+{
+    guint removed = 0;
+    guint changed = tnp_path_node_remove_owner(index->top, owner, &removed);
+
+    if(changed > 0)
+    {
+        index->size -= removed;
+        index->generation = next_generation();
+    }
+    return changed;
+}
+
+/**
+ * Finds the sync root containing "path". Only whole path components are
+ * compared, so "/home/u/Nextcloud2" is not inside "/home/u/Nextcloud". If
+ * roots are nested, the innermost one is returned.
+ * @return The sync root (owned by the index) or NULL if path is not synced
+ */
+const gchar* tnp_path_index_lookup(const TnpPathIndex* index, const gchar* path)
+{
+    return tnp_path_index_lookup_owner(index, path, NULL);
+}
+
+/**
+ * Like tnp_path_index_lookup(), but also returns the owner of the root.
+ * @param owner Set to the owner if a root was found (optional)
+ */
+const gchar* tnp_path_index_lookup_owner(const TnpPathIndex* index, const gchar* path, guint* owner)
+{
+    gchar buffer[PATH_MAX];
+    gchar* cursor = buffer;
+    gchar* component;
+    const TnpPathNode* node = index->top;
+    const TnpPathNode* match = node;
+
+    if(index->size == 0 || !copy_path(buffer, path))
+    {
+        return NULL;
+    }
+    for(component = next_component(&cursor); component != NULL; component = next_component(&cursor))
+    {
+        node = node->children == NULL ? NULL : g_hash_table_lookup(node->children, component);
+        if(node == NULL)
+        {
+            break;
+        }
+        if(node->root != NULL)
+        {
+            match = node;
+        }
+    }
+    if(owner != NULL && match->root != NULL)
+    {
+        *owner = match->owner;
+    }
+    return match->root;
+}
+
+static void tnp_path_node_list(const TnpPathNode* node, GPtrArray* roots)
+{
+    GHashTableIter iter;
+    gpointer child;
+
+    if(node->root != NULL)
+    {
+        g_ptr_array_add(roots, node->root);
+    }
+    if(node->children != NULL)
+    {
+        g_hash_table_iter_init(&iter, node->children);
+        while(g_hash_table_iter_next(&iter, NULL, &child))
+        {
+            tnp_path_node_list(child, roots);
+        }
+    }
+}
+
+static gint compare_roots(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const gchar* const*) a, *(const gchar* const*) b);
+}
+
+/**
+ * Returns all sync roots, sorted.
+ * @return A new array of roots owned by the index
+ */
+GPtrArray* tnp_path_index_list(const TnpPathIndex* index)
+{
+    GPtrArray* roots = g_ptr_array_sized_new(index->size);
+
+    tnp_path_node_list(index->top, roots);
+    g_ptr_array_sort(roots, compare_roots);
+    return roots;
+}
+
+/**
+ * @return The number of registered sync roots
+ */
+guint tnp_path_index_size(const TnpPathIndex* index)
+{
+    return index->size;
+}
+
+/**
+ * Returns a number that changes whenever roots are added, removed or handed
+ * to another owner, and is never shared by two indexes. Roots returned by
+ * tnp_path_index_lookup() stay valid while it is unchanged.
+ */
+guint tnp_path_index_generation(const TnpPathIndex* index)
+{
+    return index->generation;
+}
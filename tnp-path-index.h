@@ -0,0 +1,50 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_PATH_INDEX_H__
+#define __TNP_PATH_INDEX_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS;
+
+/**
+ * A path-component trie holding the directories synced by the Nextcloud
+ * clients. Answers "which sync root contains this path", and which client
+ * registered it, in O(path depth), independent of the number of roots.
+ */
+typedef struct _TnpPathIndex TnpPathIndex;
+
+TnpPathIndex* tnp_path_index_new (void) G_GNUC_INTERNAL;
+TnpPathIndex* tnp_path_index_copy (const TnpPathIndex* index) G_GNUC_INTERNAL;
+void tnp_path_index_free (TnpPathIndex* index) G_GNUC_INTERNAL;
+void tnp_path_index_clear (TnpPathIndex* index) G_GNUC_INTERNAL;
+gboolean tnp_path_index_insert (TnpPathIndex* index, const gchar* path, guint owner) G_GNUC_INTERNAL;
+gboolean tnp_path_index_remove (TnpPathIndex* index, const gchar* path, guint owner) G_GNUC_INTERNAL;
+guint tnp_path_index_remove_owner (TnpPathIndex* index, guint owner) G_GNUC_INTERNAL;
+const gchar* tnp_path_index_lookup (const TnpPathIndex* index, const gchar* path) G_GNUC_INTERNAL;
+const gchar* tnp_path_index_lookup_owner (const TnpPathIndex* index, const gchar* path, guint* owner) G_GNUC_INTERNAL;
+GPtrArray* tnp_path_index_list (const TnpPathIndex* index) G_GNUC_INTERNAL;
+guint tnp_path_index_size (const TnpPathIndex* index) G_GNUC_INTERNAL;
+guint tnp_path_index_generation (const TnpPathIndex* index) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_PATH_INDEX_H__ */
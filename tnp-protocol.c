@@ -0,0 +1,154 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "tnp-protocol.h"
+
+typedef struct
+{
+    const gchar* name;
+    // argument counts accepted for the command
+    guint        min_args;
+    guint        max_args;
+} TnpMessageSyntax;
+
+static const TnpMessageSyntax syntax[TNP_MESSAGE_N_TYPES] =
+{
+    [TNP_MESSAGE_UNKNOWN]         = { NULL, 0, 0 },
+    [TNP_MESSAGE_REGISTER_PATH]   = { "REGISTER_PATH", 1, 1 },
+    [TNP_MESSAGE_UNREGISTER_PATH] = { "UNREGISTER_PATH", 1, 1 },
+    [TNP_MESSAGE_STATUS]          = { "STATUS", 2, 2 },
+    [TNP_MESSAGE_UPDATE_VIEW]     = { "UPDATE_VIEW", 1, 1 },
+    [TNP_MESSAGE_SHARE]           = { "SHARE", 2, 2 },
+    [TNP_MESSAGE_GET_STRINGS]     = { "GET_STRINGS", 1, 1 },
+    [TNP_MESSAGE_STRING]          = { "STRING", 2, 2 },
+    [TNP_MESSAGE_GET_MENU_ITEMS]  = { "GET_MENU_ITEMS", 1, 1 },
+    [TNP_MESSAGE_MENU_ITEM]       = { "MENU_ITEM", 3, 3 },
+    [TNP_MESSAGE_VERSION]         = { "VERSION", 1, 2 },
+};
+
+/**
+ * Maps a command to its message type. The length alone picks the candidate,
+ * except for two pairs of equally long commands that are told apart by one
+ * character: the third for STATUS/STRING and the first for
+ * UPDATE_VIEW/GET_STRINGS. A single comparison then confirms the match.
+ */
+static TnpMessageType lookup_command(const gchar* command, gsize length)
+{
+    TnpMessageType type = TNP_MESSAGE_UNKNOWN;
+
+    switch(length)
+    {
+        case 5:
+            type = TNP_MESSAGE_SHARE;
+            break;
+        case 6:
+            type = command[2] == 'A' ? TNP_MESSAGE_STATUS : TNP_MESSAGE_STRING;
+            break;
+        case 7:
+            type = TNP_MESSAGE_VERSION;
+            break;
+        case 9:
+            type = TNP_MESSAGE_MENU_ITEM;
+            break;
+        case 11:
+            type = command[0] == 'U' ? TNP_MESSAGE_UPDATE_VIEW : TNP_MESSAGE_GET_STRINGS;
+            break;
+        case 13:
+            type = TNP_MESSAGE_REGISTER_PATH;
+            break;
+        case 14:
+            type = TNP_MESSAGE_GET_MENU_ITEMS;
+            break;
+        case 15:
+            type = TNP_MESSAGE_UNREGISTER_PATH;
+            break;
+    }
+    if(type != TNP_MESSAGE_UNKNOWN && memcmp(command, syntax[type].name, length) != 0)
+    {
+        type = TNP_MESSAGE_UNKNOWN;
+    }
+    return type;
+}
+
+/**
+ * Splits "line" into its command and arguments in place, looking at every
+ * character once.
+ * @return FALSE if the command is unknown or has the wrong number of
+ *         arguments; "message" is of type TNP_MESSAGE_UNKNOWN then
+ */
+gboolean tnp_message_parse(gchar* line, TnpMessage* message)
+{
+    gchar* separator;
+    const TnpMessageSyntax* expected;
+
+    message->type = TNP_MESSAGE_UNKNOWN;
+    message->n_args = 0;
+    separator = strchr(line, ':');
+    if(separator == NULL)
+    {
+        return FALSE;
+    }
+    message->type = lookup_command(line, separator - line);
+    if(message->type == TNP_MESSAGE_UNKNOWN)
+    {
+        return FALSE;
+    }
+    expected = &syntax[message->type];
+    // all but the last argument end at the next ':'
+    while(separator != NULL)
+    {
+        *separator = '\0';
+        message->args[message->n_args++] = separator + 1;
+        separator = message->n_args < expected->max_args ? strchr(separator + 1, ':') : NULL;
+    }
+    if(message->n_args < expected->min_args)
+    {
+        message->type = TNP_MESSAGE_UNKNOWN;
+        message->n_args = 0;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Calls the handler registered for the type of "message", if any.
+ * @return TRUE if the message was handled
+ */
+gboolean tnp_message_dispatch(const TnpMessage* message,
+                              const TnpMessageHandler handlers[TNP_MESSAGE_N_TYPES],
+                              gpointer user_data)
+{
+    if(handlers[message->type] == NULL)
+    {
+        return FALSE;
+    }
+    handlers[message->type](message, user_data);
+    return TRUE;
+}
+
+/**
+ * @return The command of messages of "type", e.g. "STATUS"
+ */
+const gchar* tnp_message_type_name(TnpMessageType type)
+{
+    return type == TNP_MESSAGE_UNKNOWN ? "UNKNOWN" : syntax[type].name;
+}
@@ -0,0 +1,85 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_PROTOCOL_H__
+#define __TNP_PROTOCOL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS;
+
+/**
+ * The messages sent by the Nextcloud client over its socket. Each one is a
+ * single line "<COMMAND>:<arg>[:<arg>...]".
+ */
+typedef enum
+{
+    TNP_MESSAGE_UNKNOWN = 0,
+    // REGISTER_PATH:<path>
+    TNP_MESSAGE_REGISTER_PATH,
+    // UNREGISTER_PATH:<path>
+    TNP_MESSAGE_UNREGISTER_PATH,
+    // STATUS:<status>:<path>
+    TNP_MESSAGE_STATUS,
+    // UPDATE_VIEW:<path>
+    TNP_MESSAGE_UPDATE_VIEW,
+    // SHARE:<result>:<path>
+    TNP_MESSAGE_SHARE,
+    // GET_STRINGS:BEGIN and GET_STRINGS:END around STRING messages
+    TNP_MESSAGE_GET_STRINGS,
+    // STRING:<name>:<text>
+    TNP_MESSAGE_STRING,
+    // GET_MENU_ITEMS:BEGIN and GET_MENU_ITEMS:END around MENU_ITEM messages
+    TNP_MESSAGE_GET_MENU_ITEMS,
+    // MENU_ITEM:<command>:<flags>:<text>
+    TNP_MESSAGE_MENU_ITEM,
+    // VERSION:<client version>[:<protocol version>]
+    TNP_MESSAGE_VERSION,
+    TNP_MESSAGE_N_TYPES,
+} TnpMessageType;
+
+// the largest number of arguments of any message
+#define TNP_MESSAGE_MAX_ARGS 3
+
+/**
+ * A message split in place. The arguments point into the parsed line; the
+ * last one extends to the end of the line, so paths may contain ':'.
+ */
+typedef struct
+{
+    TnpMessageType type;
+    guint          n_args;
+    gchar*         args[TNP_MESSAGE_MAX_ARGS];
+} TnpMessage;
+
+/**
+ * Handles a message of the type it is registered for.
+ */
+typedef void (*TnpMessageHandler) (const TnpMessage* message, gpointer user_data);
+
+gboolean tnp_message_parse (gchar* line, TnpMessage* message) G_GNUC_INTERNAL;
+gboolean tnp_message_dispatch (const TnpMessage* message,
+                               const TnpMessageHandler handlers[TNP_MESSAGE_N_TYPES],
+                               gpointer user_data) G_GNUC_INTERNAL;
+const gchar* tnp_message_type_name (TnpMessageType type) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_PROTOCOL_H__ */
@@ -18,29 +18,73 @@
  * Boston, MA 02110-1301, USA.
  */
 
-#include <errno.h>
 #include <limits.h>
 #include <unistd.h>
 #include <libxfce4util/libxfce4util.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <sys/un.h>
-#include <unistd.h>
 
+#include "tnp-client.h"
+#include "tnp-menu.h"
+#include "tnp-path-arena.h"
+#include "tnp-path-cache.h"
+#include "tnp-path-index.h"
+#include "tnp-protocol.h"
 #include "tnp-provider.h"
+#include "tnp-root-snapshot.h"
+#include "tnp-rtt.h"
+#include "tnp-stats.h"
+#include "tnp-status.h"
+
+// number of directories whose canonical path is cached
+#define PATH_CACHE_SIZE 32
+// number of menu results kept for repeated selections, see menu_memo_lookup()
+#define MENU_MEMO_SIZE 8
+// directory of the standard client's socket in the runtime directory
+#define DEFAULT_SOCKET_DIRECTORY "Nextcloud"
+// how long the sync roots of the last session are used if no client answers
+#define SNAPSHOT_GRACE_PERIOD 30
+// delay in seconds for saving changed sync roots, so a burst causes one write
+#define SNAPSHOT_SAVE_DELAY 2
+// sent after connecting, answered by VERSION: and GET_STRINGS: messages
+#define CONNECT_COMMANDS "VERSION:\nGET_STRINGS:\n"
+// how long to wait for share replies (microseconds) before any was measured,
+// and the bounds of the estimate, see tnp-rtt.h
+#define SHARE_TIMEOUT_INITIAL (2 * G_USEC_PER_SEC)
+#define SHARE_TIMEOUT_MIN (G_USEC_PER_SEC / 2)
+#define SHARE_TIMEOUT_MAX (60 * G_USEC_PER_SEC)
 
-// "SHARE:CANNOTSHAREROOT:" + path + "\n\0"
-#define SOCKET_BUFFER_SIZE PATH_MAX+24
-#define MAX_SYNCED_DIRS 128
+typedef void (*TnpShareCallback)(const gchar* path, gboolean success, gpointer user_data);
+
+/**
+ * What building a menu found out about selections of one kind in a directory.
+ */
+typedef struct
+{
+    gchar*           parent_uri;
+    TnpMenuKind      kind;
+    // the canonical path of the directory and its sync root (owned by the sync
+    // roots) or NULL, valid while the sync roots and the path cache are at
+    // these generations
+    TnpPathHandle    parent;
+    const gchar*     root;
+    guint            roots_generation;
+    guint            paths_generation;
+    // the client's menu (owned by the menu cache) or NULL, valid while the menu
+    // cache is at "menus_generation"
+    const GPtrArray* actions;
+    guint            menus_generation;
+} TnpMenuMemo;
 
 // forward declarations
-static gboolean handle_responses(const char const* share_path);
 static void tnp_provider_menu_provider_init (ThunarxMenuProviderIface* iface);
+static void tnp_provider_property_page_provider_init (ThunarxPropertyPageProviderIface* iface);
 static void tnp_provider_finalize (GObject* object);
 static GList* tnp_provider_get_file_menu_items(ThunarxMenuProvider* menu_provider,
                                             GtkWidget* window,
                                             GList* files);
+static GList* tnp_provider_get_pages(ThunarxPropertyPageProvider* page_provider, GList* files);
+static void refresh_pages(const gchar* path);
 static void tnp_provider_execute(TnpProvider* tnp_provider, GPid (*action) (const gchar* folder,
                                                                             GList* files,
                                                                             GtkWidget* window,
@@ -52,6 +96,121 @@ static void tnp_provider_execute(TnpProvider* tnp_provider, GPid (*action) (cons
 static void tnp_provider_child_watch(GPid pid, gint status, gpointer user_data);
 static void tnp_provider_child_watch_destroy(gpointer user_data);
 
+/**
+ * A "SHARE:" request that has been sent to the Nextcloud client and waits for
+ * the matching "SHARE:<status>:<path>" reply.
+ */
+typedef struct
+{
+    TnpShareCallback callback;
+    gpointer         user_data;
+    // the callback is skipped once this is cancelled (optional)
+    GCancellable*    cancellable;
+    // the key of its queue in "pending_shares"
+    TnpPathHandle    path;
+    // the connection the request was routed to or TNP_CLIENT_CONNECTION_ANY
+    guint            connection;
+    // monotonic time of sending, for the round-trip estimate
+    gint64           sent;
+    // set once the request timed out and its callback was told so; it is kept
+    // until the late reply arrives, which is then not taken for a later one's
+    gboolean         expired;
+    // for the round trip statistics
+    gint64           start;
+} TnpPendingShare;
+
+/**
+ * What a connected client told about itself, see handle_version() and
+ * handle_string().
+ */
+typedef struct
+{
+    // name -> text of the strings translated by the client
+    GHashTable* strings;
+    gchar*      version;
+} TnpClientInfo;
+
+/**
+ * State of a "Nextcloud" page in the properties dialog of a single file, see
+ * tnp_page_new(). It lives as long as the page's widget.
+ */
+typedef struct
+{
+    GtkWidget*    page;
+    // canonical path of the file
+    gchar*        path;
+    gboolean      is_directory;
+    // cancelled with the page, so replies on their way skip their callbacks
+    GCancellable* cancellable;
+    // idle callback coalescing refreshes, see refresh_pages()
+    guint         refresh_id;
+    gboolean      sharing;
+    gboolean      share_failed;
+    GtkWidget*    status_label;
+    GtkWidget*    share_label;
+    GtkWidget*    share_button;
+    GtkWidget*    copy_link_button;
+    GtkWidget*    open_link_button;
+} TnpPage;
+
+/**
+ * Everything the plugin knows about the Nextcloud clients. A single session is
+ * shared by all providers of the process, so all windows of "thunar --daemon"
+ * are served by one set of connections and one copy of the state.
+ *
+ * Reference counted: every provider holds a reference, and the plugin holds one
+ * from the first provider until thunar_extension_shutdown(), since Thunar
+ * drops providers it has not used for a while and the connections should
+ * outlive them. The last reference tears everything down, see session_free().
+ *
+ * Thread-safety: main context only. The client's worker thread never touches
+ * the session, it only talks to it through the client's queues, see
+ * tnp-client.h.
+ */
+typedef struct
+{
+    gint            ref_count;
+    // set while the session is torn down
+    gboolean        stopping;
+    // owns the connections and the sync roots, see tnp-client.h; created by
+    // start_client(), all other state below is created along with it
+    TnpClient*      client;
+    // the idle callback running start_client()
+    guint           start_id;
+    // directory name -> GFileMonitor of the client socket in it, see watch_socket_directory()
+    GHashTable*     socket_monitors;
+    GFileMonitor*   runtime_monitor;
+    // interned canonical paths, shared by the caches below
+    TnpPathArena*   path_arena;
+    TnpPathCache*   path_cache;
+    TnpStatusCache* status_cache;
+    TnpMenuCache*   menu_cache;
+    // TnpMenuMemo of the latest menus, most recently used first
+    GQueue          menu_memo;
+    // canonical path handle -> ThunarxFileInfo of the files shown in a menu,
+    // weakly referenced, so Thunar can be told about their changes
+    GHashTable*     file_infos;
+    // path handle -> GQueue of TnpPendingShare, in the order the requests were sent
+    GHashTable*     pending_shares;
+    // the pending shares that have not timed out and the timeout running for
+    // them, see update_share_timeout()
+    guint           waiting_shares;
+    guint           share_timeout_id;
+    TnpRtt*         share_rtt;
+    // sync roots saved by the last session, used until the clients registered
+    // theirs again, see get_synced_dirs()
+    TnpPathIndex*   snapshot_dirs;
+    // connections found while the snapshot is used that neither answered
+    // VERSION: nor failed yet, see settle_connection()
+    GHashTable*     unsettled;
+    guint           snapshot_expire_id;
+    guint           snapshot_save_id;
+    // connection -> TnpClientInfo of the clients that sent strings or a version
+    GHashTable*     clients;
+    // TnpPage of the open property pages
+    GList*          open_pages;
+} TnpSession;
+
 struct _TnpProviderClass
 {
     GObjectClass __parent__;
@@ -71,6 +230,9 @@ struct _TnpProvider
 
     // taken from thunar-archive-plugin and kept just to be safe
     gint            child_watch_id;
+
+    // a reference to the session of the process
+    TnpSession*     session;
 };
 
 static GQuark tnp_item_files_quark;
@@ -78,417 +240,1834 @@ static GQuark tnp_item_files_quark;
 static GQuark tnp_item_folder_quark;
 #endif
 static GQuark tnp_item_provider_quark;
+// the client's command for items of the client's menu
+static GQuark tnp_item_command_quark;
 
 THUNARX_DEFINE_TYPE_WITH_CODE(TnpProvider,
                               tnp_provider,
                               G_TYPE_OBJECT,
                               THUNARX_IMPLEMENT_INTERFACE (THUNARX_TYPE_MENU_PROVIDER,
-                                                           tnp_provider_menu_provider_init));
+                                                           tnp_provider_menu_provider_init)
+                              THUNARX_IMPLEMENT_INTERFACE (THUNARX_TYPE_PROPERTY_PAGE_PROVIDER,
+                                                           tnp_provider_property_page_provider_init));
 
 
-static int nextcloud_client_socket = -1;
-char synced_dirs[MAX_SYNCED_DIRS][PATH_MAX] = {0};
-char socket_buffer[SOCKET_BUFFER_SIZE] = {0};
-size_t socket_buffer_index = 0;
-struct timeval socket_timeout = {.tv_sec = 0, .tv_usec = 500000};
+// the session of the process, see TnpSession
+static TnpSession* session = NULL;
 
-/**
- * Disconnects the nextcloud_client_socket connection. After calling this
- * function, nextcloud_client_socket is -1.
- */
-static void disconnect_socket()
+static void socket_monitor_free(gpointer data)
 {
-    size_t i;
-    if(nextcloud_client_socket >= 0)
+    if(data != NULL)
     {
-        close(nextcloud_client_socket);
+        g_file_monitor_cancel(data);
+        g_object_unref(data);
     }
-    nextcloud_client_socket = -1;
-    // delete list of synced dirs
-    for(i = 0; i < MAX_SYNCED_DIRS; i++)
+}
+
+static void pending_share_free(TnpPendingShare* pending)
+{
+    if(pending->cancellable != NULL)
     {
-        synced_dirs[i][0] = '\0';
+        g_object_unref(pending->cancellable);
     }
-    // clear socket buffer
-    socket_buffer_index = 0;
-    socket_buffer[0] = '\0';
+    g_free(pending);
 }
 
 /**
- * Connect to the unix socket of the Nextcloud client
- * If the connection is successful, the variable nextcloud_client_socket will
- * hold the file descriptor of the connected socket. If the connection failed,
- * the variable will be -1.
- * @return -1 if the connection failed, 0 if it succeeded
+ * Invokes the callback of a finished share request, unless whoever sent it
+ * has gone away in the meantime, and frees it.
  */
-static int connect_socket()
+static void pending_share_finish(TnpPendingShare* pending, const gchar* path, gboolean success)
+{
+    if(!pending->expired && (pending->cancellable == NULL || !g_cancellable_is_cancelled(pending->cancellable)))
+    {
+        pending->callback(path, success, pending->user_data);
+    }
+    pending_share_free(pending);
+}
+
+static void pending_share_queue_free(gpointer data)
+{
+    g_queue_free_full(data, (GDestroyNotify) pending_share_free);
+}
+
+static void pending_share_path_free(gpointer data)
+{
+    tnp_path_arena_unref(session->path_arena, TNP_POINTER_TO_PATH_HANDLE(data));
+}
+
+static GHashTable* pending_shares_new()
 {
-    // taken from the unix(7) manpage
-    struct sockaddr_un addr;
-    int ret;
-    char const* xdg_runtime_dir;
-    static const char const* nextcloud_client_socket_relpath = "/Nextcloud/socket";
+    return g_hash_table_new_full(g_direct_hash, g_direct_equal, pending_share_path_free, pending_share_queue_free);
+}
 
+static gboolean share_timeout(gpointer user_data);
 
-    // if socket is still connected, abort
-    if(nextcloud_client_socket >= 0)
+/**
+ * Starts the timeout of the pending share requests if needed, or stops it
+ * once none of them waits for its reply anymore. Like TCP's retransmission
+ * timer, it keeps running while requests are sent and is only restarted when
+ * a reply shows that the client makes "progress", so a busy client answering
+ * slowly but steadily is not given up on.
+ */
+static void update_share_timeout(gboolean progress)
+{
+    if(session->share_timeout_id != 0 && (progress || session->waiting_shares == 0))
     {
-        return 0;
+        g_source_remove(session->share_timeout_id);
+        session->share_timeout_id = 0;
     }
-
-    /* Create local socket. */
-    nextcloud_client_socket = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (nextcloud_client_socket == -1)
+    if(session->share_timeout_id == 0 && session->waiting_shares > 0)
     {
-        #ifdef G_ENABLE_DEBUG
-        g_message("socket() failed! %s", strerror(errno));
-        #endif
-        return -1;
+        session->share_timeout_id = g_timeout_add(MAX(tnp_rtt_get_timeout(session->share_rtt) / 1000, 1),
+                                                  share_timeout, NULL);
     }
+}
+
+/**
+ * Gives up on the share requests that got no reply within the timeout, as
+ * the client made no progress for that long. Their callbacks are told that
+ * they failed, but they stay queued, so their late replies are still matched
+ * to them instead of being taken for the replies of later requests.
+ */
+static gboolean share_timeout(gpointer user_data)
+{
+    GHashTableIter iter;
+    gpointer queue;
+    GList* link;
+    GQueue expired;
+    TnpPendingShare* pending;
+    TnpPendingShare* copy;
+    TnpPathHandle handle;
+    gint64 now = g_get_monotonic_time();
+    gint64 timeout = tnp_rtt_get_timeout(session->share_rtt);
 
-    if(setsockopt(nextcloud_client_socket,
-                  SOL_SOCKET,
-                  SO_RCVTIMEO,
-                  (char*) &socket_timeout,
-                  sizeof(socket_timeout)) < 0 ||
-       setsockopt(nextcloud_client_socket,
-                  SOL_SOCKET,
-                  SO_SNDTIMEO,
-                  (char*) &socket_timeout,
-                  sizeof(socket_timeout)) < 0)
+    session->share_timeout_id = 0;
+    // callbacks may send new requests or run a main loop handling the late
+    // replies, so they are invoked on copies after collecting them
+    g_queue_init(&expired);
+    g_hash_table_iter_init(&iter, session->pending_shares);
+    while(g_hash_table_iter_next(&iter, NULL, &queue))
+    {
+        for(link = ((GQueue*) queue)->head; link != NULL; link = link->next)
+        {
+            pending = link->data;
+            if(pending->expired || now - pending->sent < timeout)
+            {
+                continue;
+            }
+            copy = g_new(TnpPendingShare, 1);
+            *copy = *pending;
+            if(copy->cancellable != NULL)
+            {
+                g_object_ref(copy->cancellable);
+            }
+            tnp_path_arena_ref(session->path_arena, copy->path);
+            g_queue_push_tail(&expired, copy);
+            pending->expired = TRUE;
+            session->waiting_shares--;
+            tnp_stats_add(TNP_STATS_SHARE_TIMEOUTS, 1);
+        }
+    }
+    if(!g_queue_is_empty(&expired))
+    {
+        tnp_rtt_backoff(session->share_rtt);
+    }
+    update_share_timeout(FALSE);
+    while((copy = g_queue_pop_head(&expired)) != NULL)
     {
+        handle = copy->path;
         #ifdef G_ENABLE_DEBUG
-        g_message("setsockopt() failed! %s", strerror(errno));
+        g_message("Share request timed out: %s", tnp_path_arena_get(session->path_arena, handle));
         #endif
-        return -1;
+        pending_share_finish(copy, tnp_path_arena_get(session->path_arena, handle), FALSE);
+        tnp_path_arena_unref(session->path_arena, handle);
     }
+    return G_SOURCE_REMOVE;
+}
 
-    /*
-    * For portability clear the whole structure, since some
-    * implementations have additional (nonstandard) fields in
-    * the structure.
-    */
-    memset(&addr, 0, sizeof(struct sockaddr_un));
+/**
+ * Completes the oldest pending share request for "path" by invoking its
+ * callback, unless it timed out already. Replies nobody waits for are
+ * ignored.
+ */
+static void complete_share(const gchar* path, gboolean success)
+{
+    TnpPathHandle handle = tnp_path_arena_lookup(session->path_arena, path);
+    GQueue* queue = NULL;
+    TnpPendingShare* pending;
 
-    /* Connect socket to socket address */
-    addr.sun_family = AF_UNIX;
-    xdg_runtime_dir = g_getenv("XDG_RUNTIME_DIR");
-    snprintf(addr.sun_path, strlen(xdg_runtime_dir) + strlen(nextcloud_client_socket_relpath) + 1,
-             "%s%s", xdg_runtime_dir, nextcloud_client_socket_relpath);
-    ret = connect(nextcloud_client_socket, (const struct sockaddr*) &addr, sizeof(struct sockaddr_un));
-    if (ret == -1)
+    if(handle != TNP_PATH_HANDLE_NONE)
+    {
+        queue = g_hash_table_lookup(session->pending_shares, TNP_PATH_HANDLE_TO_POINTER(handle));
+    }
+    if(queue == NULL)
     {
         #ifdef G_ENABLE_DEBUG
-        g_message("connect() failed! %s", strerror(errno));
+        g_message("Ignoring unexpected share reply for: %s", path);
         #endif
-        disconnect_socket();
+        return;
     }
-    else
+    pending = g_queue_pop_head(queue);
+    // the callback may queue new requests, so take the entry out first
+    if(g_queue_is_empty(queue))
+    {
+        g_hash_table_remove(session->pending_shares, TNP_PATH_HANDLE_TO_POINTER(handle));
+    }
+    // late replies are measured too, so the timeout adapts to a slower client
+    tnp_rtt_sample(session->share_rtt, g_get_monotonic_time() - pending->sent);
+    if(pending->expired)
     {
+        tnp_stats_add(TNP_STATS_LATE_REPLIES, 1);
         #ifdef G_ENABLE_DEBUG
-        g_message("Connected to '%s'", addr.sun_path);
+        g_message("Late share reply for: %s", path);
         #endif
-        // handle immediate messages
-        handle_responses(NULL);
     }
-    return ret;
+    else
+    {
+        session->waiting_shares--;
+    }
+    update_share_timeout(TRUE);
+    tnp_stats_record(TNP_STATS_SHARE_ROUND_TRIP, pending->start);
+    pending_share_finish(pending, path, success);
 }
 
 /**
- * Handle one or many messages from the nextcloud client if there is one on the
- * socket. If "share_path" is non-NULL, it will block until a "SHARE:"
- * message is received whose tail matches the share_path. Will return TRUE if
- * "share_path" was NULL or if a "SHARE:OK:" message was received. Will return
- * FALSE otherwise.
- * @param share_path Path to wait for
+ * Fails the pending share requests sent to "connection", and those whose
+ * connection is unknown, e.g. because the connection was lost and their
+ * replies will never arrive. TNP_CLIENT_CONNECTION_ANY fails all of them.
  */
-static gboolean handle_responses(const char const* share_path)
+static void fail_pending_shares(guint connection)
 {
-    char* newline_pos;
-    int read_status;
-    size_t i;
-    char realpath_buffer[PATH_MAX];
-    int recv_flag = share_path == NULL ? MSG_DONTWAIT : 0;
-    gboolean retval = TRUE;
-    // make sure the socket is connected
-    if(nextcloud_client_socket == -1)
+    GHashTableIter iter;
+    gpointer queue;
+    GList* link;
+    GList* next;
+    GQueue failed;
+    TnpPendingShare* pending;
+    TnpPathHandle handle;
+
+    if(session->pending_shares == NULL || g_hash_table_size(session->pending_shares) == 0)
     {
-        #ifdef G_ENABLE_DEBUG
-        g_message("Not connected yet!");
-        #endif
-        if(connect_socket() == -1)
-        {
-            #ifdef G_ENABLE_DEBUG
-            g_message("Socket not connected and connection failed");
-            #endif
-            return FALSE;
-        }
+        return;
     }
-    // repeat as long as there is data on the socket
-    do
+    // callbacks may send new requests, so collect the failed ones first
+    g_queue_init(&failed);
+    g_hash_table_iter_init(&iter, session->pending_shares);
+    while(g_hash_table_iter_next(&iter, NULL, &queue))
     {
-        // try to fill the buffer
-        read_status = recv(nextcloud_client_socket, socket_buffer + socket_buffer_index, SOCKET_BUFFER_SIZE - socket_buffer_index - 1, recv_flag);
-        if(read_status > 0)
-        {
-            socket_buffer_index += read_status;
-            socket_buffer[socket_buffer_index] = '\0';
-        }
-        else if(errno != EAGAIN && errno != EWOULDBLOCK)
+        for(link = ((GQueue*) queue)->head; link != NULL; link = next)
         {
-            disconnect_socket();
-            if(connect_socket() == 0)
-                read_status = 1;
-            else
-            {
-                retval = FALSE;
-                break;
-            }
-        }
-        // repeat as long as there are complete lines in the buffer
-        for(newline_pos = strchr(socket_buffer, '\n'); newline_pos != NULL; newline_pos = strchr(socket_buffer, '\n'))
-        {
-            // substitute newline for '\0' for easier string handling
-            *newline_pos = '\0';
-            // if a new directory is synced, add it
-            if(strncmp(socket_buffer, "REGISTER_PATH:", strlen("REGISTER_PATH:")) == 0)
-            {
-                // find first empty entry
-                for(i = 0; i < MAX_SYNCED_DIRS && synced_dirs[i][0] != '\0'; i++);
-                if(i != MAX_SYNCED_DIRS)
-                {
-                    char* path = socket_buffer + strlen("REGISTER_PATH:");
-                    // dereference directory
-                    if(realpath(path, realpath_buffer) == NULL)
-                    {
-                        #ifdef G_ENABLE_DEBUG
-                        g_message("Failed to resolve path: %s", path);
-                        #endif
-                    }
-                    else
-                    {
-                        // copy dirname
-                        strcpy(synced_dirs[i], realpath_buffer);
-                        #ifdef G_ENABLE_DEBUG
-                        g_message("Added directory: %s", synced_dirs[i]);
-                        #endif
-                    }
-                }
-                else
-                {
-                    #ifdef G_ENABLE_DEBUG
-                    g_message("No space left for shared directories!");
-                    #endif
-                }
-            }
-            // if a directory is no longer synced, remove it
-            else if(strncmp(socket_buffer, "UNREGISTER_PATH:", strlen("UNREGISTER_PATH:")) == 0)
-            {
-                // find corresponding entry
-                for(i = 0; i < MAX_SYNCED_DIRS; i++)
-                {
-                    if(strcmp(socket_buffer + strlen("UNREGISTER_PATH:"), synced_dirs[i]) == 0)
-                    {
-                        // remove
-                        synced_dirs[i][0] = '\0';
-                        #ifdef G_ENABLE_DEBUG
-                        g_message("Removed directory: %s", synced_dirs[i]);
-                        #endif
-                        break;
-                    }
-                }
-            }
-            // check if the message relates to the requested directory
-            else if(share_path != NULL &&
-                    strncmp(socket_buffer, "SHARE:", strlen("SHARE:")) == 0 && // begins with "SHARE:"
-                    strcmp(strchr(socket_buffer + 6, ':') + 1, share_path) == 0) // ends with share_path after "SHARE:FOO:"
+            next = link->next;
+            pending = link->data;
+            if(connection == TNP_CLIENT_CONNECTION_ANY || pending->connection == connection ||
+               pending->connection == TNP_CLIENT_CONNECTION_ANY)
             {
-                if(strncmp(socket_buffer + 6, "NOP:", 4) == 0)
-                {
-                    #ifdef G_ENABLE_DEBUG
-                    g_message("Failed to share path: %s", share_path);
-                    g_message("Response: '%s'", socket_buffer);
-                    #endif
-                    retval = FALSE;
-                }
-                else
+                if(!pending->expired)
                 {
-                    #ifdef G_ENABLE_DEBUG
-                    g_message("Successfully shared path: %s", share_path);
-                    #endif
-                    retval = TRUE;
+                    session->waiting_shares--;
                 }
+                tnp_path_arena_ref(session->path_arena, pending->path);
+                g_queue_unlink(queue, link);
+                g_queue_push_tail_link(&failed, link);
             }
-            // all other messsages can be ignored
-            // remove line from the buffer
-            memmove(socket_buffer, newline_pos + 2, SOCKET_BUFFER_SIZE - (newline_pos - socket_buffer + 2));
-            socket_buffer_index -= newline_pos - socket_buffer + 1;
         }
+        if(g_queue_is_empty(queue))
+        {
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+    update_share_timeout(FALSE);
+    while((pending = g_queue_pop_head(&failed)) != NULL)
+    {
+        handle = pending->path;
+        pending_share_finish(pending, tnp_path_arena_get(session->path_arena, handle), FALSE);
+        tnp_path_arena_unref(session->path_arena, handle);
     }
-    while(read_status > 0);
-    return retval;
 }
 
-static void tnp_share_item(ThunarxMenuItem *item, GtkWidget* window)
+static void file_info_finalized(gpointer data, GObject* where_the_object_was)
 {
-    GList* files;
-    gchar* path;
-    gchar* path_unescaped;
-    char realpath_buffer[PATH_MAX];
-    GtkWidget *dialog;
+    g_hash_table_remove(session->file_infos, data);
+    tnp_path_arena_unref(session->path_arena, TNP_POINTER_TO_PATH_HANDLE(data));
+}
 
-    /* determine the files associated with the action */
-    files = g_object_get_qdata (G_OBJECT (item), tnp_item_files_quark);
-    if (G_UNLIKELY (files == NULL || files->next != NULL))
+/**
+ * Remembers "file_info" as the file at the canonical "path" until Thunar
+ * drops it.
+ */
+static void track_file_info(ThunarxFileInfo* file_info, const gchar* path)
+{
+    TnpPathHandle handle = tnp_path_arena_lookup(session->path_arena, path);
+    GObject* known = NULL;
+
+    if(handle != TNP_PATH_HANDLE_NONE)
+    {
+        known = g_hash_table_lookup(session->file_infos, TNP_PATH_HANDLE_TO_POINTER(handle));
+    }
+    if(known == G_OBJECT(file_info))
     {
         return;
     }
+    if(known != NULL)
+    {
+        // the key keeps its reference for the new info
+        g_object_weak_unref(known, file_info_finalized, TNP_PATH_HANDLE_TO_POINTER(handle));
+    }
+    else
+    {
+        handle = tnp_path_arena_intern(session->path_arena, path);
+    }
+    g_object_weak_ref(G_OBJECT(file_info), file_info_finalized, TNP_PATH_HANDLE_TO_POINTER(handle));
+    g_hash_table_insert(session->file_infos, TNP_PATH_HANDLE_TO_POINTER(handle), file_info);
+}
 
-    // get the file's path
-    path = thunarx_file_info_get_uri(files->data);
-    path_unescaped = g_filename_from_uri(path, NULL, NULL);
-    g_free(path);
-    if(realpath(path_unescaped, realpath_buffer) == NULL)
+/**
+ * Changed function of the status cache: tells Thunar about files whose status
+ * changed, but only those it has shown to the plugin, and updates the open
+ * property pages.
+ */
+static void status_changed(const gchar* path, TnpSyncStatus status, gboolean shared, gpointer user_data)
+{
+    TnpPathHandle handle = tnp_path_arena_lookup(session->path_arena, path);
+    ThunarxFileInfo* file_info;
+
+    refresh_pages(path);
+    if(handle == TNP_PATH_HANDLE_NONE)
+    {
+        return;
+    }
+    file_info = g_hash_table_lookup(session->file_infos, TNP_PATH_HANDLE_TO_POINTER(handle));
+    if(file_info != NULL)
     {
         #ifdef G_ENABLE_DEBUG
-        g_message("Failed to resolve path '%s'", path_unescaped);
+        g_message("Status of %s changed to %d", path, status);
         #endif
-        g_free(path_unescaped);
-        return;
+        thunarx_file_info_changed(file_info);
     }
-    g_free(path_unescaped);
+}
 
-    send(nextcloud_client_socket, "SHARE:", 6, 0);
-    send(nextcloud_client_socket, realpath_buffer, strlen(realpath_buffer), 0);
-    send(nextcloud_client_socket, "\n", 1, 0);
-    if(handle_responses(realpath_buffer) == FALSE)
+/**
+ * Returns the sync roots to answer lookups with: those of the last session
+ * while the clients have not registered theirs yet, the live ones afterwards.
+ */
+static const TnpPathIndex* get_synced_dirs()
+{
+    return session->snapshot_dirs != NULL ? session->snapshot_dirs : tnp_client_get_synced_dirs(session->client);
+}
+
+/**
+ * Switches lookups over to the live sync roots.
+ */
+static void drop_snapshot()
+{
+    if(session->snapshot_expire_id != 0)
     {
-        /* display an error dialog */
-        dialog = gtk_message_dialog_new (GTK_WINDOW (window),
-                                         GTK_DIALOG_DESTROY_WITH_PARENT
-                                         | GTK_DIALOG_MODAL,
-                                         GTK_MESSAGE_ERROR,
-                                         GTK_BUTTONS_CLOSE,
-                                         "Failed to share item");
-        gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (dialog), "Failed to share the path '%s'.", realpath_buffer);
-        gtk_dialog_run (GTK_DIALOG (dialog));
-        gtk_widget_destroy (dialog);
+        g_source_remove(session->snapshot_expire_id);
+        session->snapshot_expire_id = 0;
     }
+    tnp_path_index_free(session->snapshot_dirs);
+    session->snapshot_dirs = NULL;
+    g_hash_table_remove_all(session->unsettled);
 }
 
-static GList* tnp_provider_get_file_menu_items(ThunarxMenuProvider* menu_provider,
-                                            GtkWidget* window,
-                                            GList* files)
+static gboolean snapshot_expired(gpointer user_data)
 {
-    gchar* uri_scheme, * path, * path_unescaped;
-    char realpath_buffer[PATH_MAX];
-    char* tooltip_name_dir = "Share the selected directory via Nextcloud";
-    char* tooltip_name_file = "Share the selected file via Nextcloud";
-    char* tooltip = tooltip_name_dir;
-    size_t i, synced_dir_len;
-    gboolean is_synced = FALSE;
+    session->snapshot_expire_id = 0;
+    #ifdef G_ENABLE_DEBUG
+    g_message("No client registered its sync roots, dropping the snapshot");
+    #endif
+    drop_snapshot();
+    return G_SOURCE_REMOVE;
+}
 
-    TnpProvider* tnp_provider = TNP_PROVIDER (menu_provider);
-    ThunarxMenuItem *item = NULL;
-    GClosure* closure;
-    GList* items = NULL;
+/**
+ * Loads the sync roots of the last session so the first menus can be built
+ * before any client is connected.
+ */
+static void load_snapshot()
+{
+    gchar* filename = tnp_root_snapshot_get_path();
 
-    // we cannot share more than one item at a time
-    if(files->next != NULL)
+    session->snapshot_dirs = tnp_root_snapshot_load(filename, TNP_CLIENT_CONNECTION_ANY);
+    if(session->snapshot_dirs != NULL)
     {
-        return NULL;
+        session->snapshot_expire_id = g_timeout_add_seconds(SNAPSHOT_GRACE_PERIOD, snapshot_expired, NULL);
     }
-    // items must be local
-    uri_scheme = thunarx_file_info_get_uri_scheme (files->data);
-    if (G_UNLIKELY (strcmp (uri_scheme, "file")))
+    g_free(filename);
+}
+
+static gboolean save_snapshot(gpointer user_data)
+{
+    gchar* filename;
+
+    session->snapshot_save_id = 0;
+    // a client that quit took its roots along, keep the ones saved before
+    if(!tnp_client_is_connected(session->client))
     {
-        g_free (uri_scheme);
-        return NULL;
+        return G_SOURCE_REMOVE;
     }
-    g_free (uri_scheme);
-    // handle pending messages on socket to make sure the list of synced dirs is up to date
-    handle_responses(NULL);
+    filename = tnp_root_snapshot_get_path();
+    tnp_root_snapshot_save(filename, tnp_client_get_synced_dirs(session->client));
+    g_free(filename);
+    return G_SOURCE_REMOVE;
+}
 
-    // check if entry is direct descendant of a synced directory
-    // i.e. check if the parent is either a synced dir or a descendant
-    path = thunarx_file_info_get_parent_uri(files->data);
-    path_unescaped = g_filename_from_uri(path, NULL, NULL);
-    g_free(path);
-    if(realpath(path_unescaped, realpath_buffer) == NULL)
-    // dereference the path minus the leading "file://"
-    if(realpath(path + 7, realpath_buffer) == NULL)
+/**
+ * Saves the live sync roots for the next session once they settled.
+ */
+static void schedule_save_snapshot()
+{
+    if(session->snapshot_save_id == 0)
     {
-        g_free(path_unescaped);
-        #ifdef G_ENABLE_DEBUG
-        g_message("Failed to resolve path: %s", path_unescaped);
-        #endif
-        return NULL;
+        session->snapshot_save_id = g_timeout_add_seconds(SNAPSHOT_SAVE_DELAY, save_snapshot, NULL);
     }
-    g_free(path_unescaped);
-    for(i = 0; i < MAX_SYNCED_DIRS; i++)
+}
+
+/**
+ * Marks "connection" as having registered all of its sync roots, or as not
+ * going to. Once every client found so far is settled, the live roots are
+ * complete and replace the snapshot, which is saved again.
+ */
+static void settle_connection(guint connection)
+{
+    if(session->snapshot_dirs == NULL || !g_hash_table_remove(session->unsettled, GUINT_TO_POINTER(connection)))
     {
-        if(*synced_dirs[i] == '\0')
-            continue;
-        synced_dir_len = strlen(synced_dirs[i]);
-        if(strncmp(synced_dirs[i], realpath_buffer, strlen(synced_dirs[i])) == 0)
-        {
-            is_synced = TRUE;
-        }
+        return;
     }
-    if(!is_synced)
+    if(g_hash_table_size(session->unsettled) == 0)
     {
-        return NULL;
+        drop_snapshot();
+        schedule_save_snapshot();
     }
+}
 
-    // select the correct tooltip
-    if(!thunarx_file_info_is_directory(files->data))
+/**
+ * Adds a connection for the client socket "file" if it exists or "force" is
+ * set. Sockets that are already connected are not added twice.
+ */
+static void add_socket(GFile* file, gboolean force)
+{
+    gchar* path;
+    guint connection;
+
+    if(!force && !g_file_query_exists(file, NULL))
     {
-        tooltip = tooltip_name_file;
+        return;
     }
-    // append the "Share" action
-    item = thunarx_menu_item_new("Tnp::share",
-                                 _("Share via _Nextcloud"),
-                                 tooltip,
-                                 "Nextcloud");
-
-    g_object_set_qdata_full (G_OBJECT (item), tnp_item_files_quark, 
-                             thunarx_file_info_list_copy (files),
-                             (GDestroyNotify) thunarx_file_info_list_free);
-
-    g_object_set_qdata_full (G_OBJECT (item), tnp_item_provider_quark,
-                             g_object_ref (G_OBJECT (tnp_provider)),
-                             (GDestroyNotify) g_object_unref);
-
-    closure = g_cclosure_new_object (G_CALLBACK (tnp_share_item), G_OBJECT (window));
-
-    g_signal_connect_closure (G_OBJECT (item), "activate", closure, TRUE);
-
-    items = g_list_append (items, item);
-    return items;
+    path = g_file_get_path(file);
+    #ifdef G_ENABLE_DEBUG
+    g_message("Using client socket: %s", path);
+    #endif
+    connection = tnp_client_add_socket(session->client, path);
+    // the snapshot is kept until this client registered its roots too
+    if(session->snapshot_dirs != NULL)
+    {
+        g_hash_table_add(session->unsettled, GUINT_TO_POINTER(connection));
+    }
+    g_free(path);
 }
 
+/**
+ * Connects right away when a client (re)creates its socket instead of
+ * waiting for the backoff timer.
+ */
+static void socket_monitor_changed(GFileMonitor* monitor,
+                                   GFile* file,
+                                   GFile* other_file,
+                                   GFileMonitorEvent event,
+                                   gpointer user_data)
+{
+    if(event == G_FILE_MONITOR_EVENT_CREATED)
+    {
+        #ifdef G_ENABLE_DEBUG
+        g_message("Client socket appeared");
+        #endif
+        add_socket(file, TRUE);
+        tnp_client_reconnect(session->client);
+    }
+}
 
+/**
+ * Starts watching for the socket of a client in the directory "name" of the
+ * runtime directory. Every client instance and branding has its own directory,
+ * named after the application, e.g. "Nextcloud".
+ * @param force Connect even if the socket does not exist yet
+ */
+static void watch_socket_directory(const gchar* name, gboolean force)
+{
+    GFile* file;
+    GFileMonitor* monitor;
+    gchar* path;
 
+    if(g_hash_table_contains(session->socket_monitors, name))
+    {
+        return;
+    }
+    path = g_build_filename(g_get_user_runtime_dir(), name, "socket", NULL);
+    file = g_file_new_for_path(path);
+    g_free(path);
+    add_socket(file, force);
+    monitor = g_file_monitor_file(file, G_FILE_MONITOR_NONE, NULL, NULL);
+    g_object_unref(file);
+    if(monitor != NULL)
+    {
+        g_signal_connect(monitor, "changed", G_CALLBACK(socket_monitor_changed), NULL);
+    }
+    // remember failed monitors too, so they are not retried over and over
+    g_hash_table_insert(session->socket_monitors, g_strdup(name), monitor);
+}
 
+/**
+ * Watches directories created in the runtime directory, which may belong to a
+ * client that is starting.
+ */
+static void runtime_monitor_changed(GFileMonitor* monitor,
+                                    GFile* file,
+                                    GFile* other_file,
+                                    GFileMonitorEvent event,
+                                    gpointer user_data)
+{
+    gchar* name;
 
-
-
-
-
+    if(event == G_FILE_MONITOR_EVENT_CREATED &&
+       g_file_query_file_type(file, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL) == G_FILE_TYPE_DIRECTORY)
+    {
+        name = g_file_get_basename(file);
+        watch_socket_directory(name, FALSE);
+        g_free(name);
+    }
+}
 
 /**
- * No idea what these do
+ * Connects to the sockets of all clients found in the runtime directory and
+ * watches for new ones. The standard client's socket is always used, so it is
+ * connected as soon as the client starts.
  */
-static void tnp_provider_class_init(TnpProviderClass* classname)
+static void discover_sockets()
 {
-    GObjectClass* gobject_class;
+    const gchar* runtime_dir = g_get_user_runtime_dir();
+    const gchar* name;
+    gchar* path;
+    GDir* dir;
+    GFile* file;
 
-    /* determine the "tnp-item-files", "tnp-item-folder" and "tnp-item-provider" quarks */
-    tnp_item_files_quark = g_quark_from_string("tnp-item-files");
+    session->socket_monitors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, socket_monitor_free);
+    watch_socket_directory(DEFAULT_SOCKET_DIRECTORY, TRUE);
+    dir = g_dir_open(runtime_dir, 0, NULL);
+    if(dir != NULL)
+    {
+        while((name = g_dir_read_name(dir)) != NULL)
+        {
+            path = g_build_filename(runtime_dir, name, NULL);
+            if(g_file_test(path, G_FILE_TEST_IS_DIR) && !g_file_test(path, G_FILE_TEST_IS_SYMLINK))
+            {
+                watch_socket_directory(name, FALSE);
+            }
+            g_free(path);
+        }
+        g_dir_close(dir);
+    }
+    file = g_file_new_for_path(runtime_dir);
+    session->runtime_monitor = g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, NULL);
+    g_object_unref(file);
+    if(session->runtime_monitor != NULL)
+    {
+        g_signal_connect(session->runtime_monitor, "changed", G_CALLBACK(runtime_monitor_changed), NULL);
+    }
+}
+
+/**
+ * A reply to one of our share requests: "SHARE:<result>:<path>"
+ */
+static void handle_share(const TnpMessage* message, gpointer user_data)
+{
+    const gchar* result = message->args[0];
+    const gchar* path = message->args[1];
+
+    if(strcmp(result, "NOP") == 0)
+    {
+        #ifdef G_ENABLE_DEBUG
+        g_message("Failed to share path: %s", path);
+        #endif
+        complete_share(path, FALSE);
+    }
+    else
+    {
+        #ifdef G_ENABLE_DEBUG
+        g_message("Successfully shared path: %s (%s)", path, result);
+        #endif
+        complete_share(path, TRUE);
+    }
+}
+
+/**
+ * A status reply or push message: "STATUS:<status>:<path>"
+ */
+static void handle_status(const TnpMessage* message, gpointer user_data)
+{
+    tnp_status_cache_update(session->status_cache, message->args[0], message->args[1]);
+}
+
+/**
+ * Parts of a reply to "GET_MENU_ITEMS:", see tnp-menu.h
+ */
+static void handle_menu_items(const TnpMessage* message, gpointer user_data)
+{
+    const TnpClientEvent* event = user_data;
+
+    tnp_menu_cache_handle_message(session->menu_cache, event->connection, message);
+}
+
+/**
+ * The client asks to refresh everything shown for "UPDATE_VIEW:<path>". Only
+ * the state below that path is dropped; files in it that were shown to the
+ * plugin are reported to Thunar as their statuses are forgotten.
+ */
+static void handle_update_view(const TnpMessage* message, gpointer user_data)
+{
+    tnp_status_cache_invalidate(session->status_cache, message->args[0]);
+    tnp_menu_cache_invalidate(session->menu_cache, message->args[0]);
+}
+
+static void client_info_free(gpointer data)
+{
+    TnpClientInfo* info = data;
+    g_hash_table_destroy(info->strings);
+    g_free(info->version);
+    g_slice_free(TnpClientInfo, info);
+}
+
+/**
+ * Returns what the client on "connection" told about itself so far.
+ */
+static TnpClientInfo* get_client_info(guint connection)
+{
+    TnpClientInfo* info = g_hash_table_lookup(session->clients, GUINT_TO_POINTER(connection));
+
+    if(info == NULL)
+    {
+        info = g_slice_new0(TnpClientInfo);
+        info->strings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        g_hash_table_insert(session->clients, GUINT_TO_POINTER(connection), info);
+    }
+    return info;
+}
+
+/**
+ * Looks up a string translated by the client on "connection", or by any
+ * client if that one did not send it.
+ * @return The text or NULL if no client sent the string
+ */
+static const gchar* get_client_string(guint connection, const gchar* name)
+{
+    TnpClientInfo* info = g_hash_table_lookup(session->clients, GUINT_TO_POINTER(connection));
+    const gchar* text = info != NULL ? g_hash_table_lookup(info->strings, name) : NULL;
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, session->clients);
+    while(text == NULL && g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        text = g_hash_table_lookup(((TnpClientInfo*) value)->strings, name);
+    }
+    return text;
+}
+
+/**
+ * "GET_STRINGS:BEGIN" starts a new set of translated strings of the client.
+ */
+static void handle_get_strings(const TnpMessage* message, gpointer user_data)
+{
+    const TnpClientEvent* event = user_data;
+
+    if(strcmp(message->args[0], "BEGIN") == 0)
+    {
+        g_hash_table_remove_all(get_client_info(event->connection)->strings);
+    }
+}
+
+/**
+ * A translated string of the client: "STRING:<name>:<text>"
+ */
+static void handle_string(const TnpMessage* message, gpointer user_data)
+{
+    const TnpClientEvent* event = user_data;
+
+    g_hash_table_replace(get_client_info(event->connection)->strings,
+                         g_strdup(message->args[0]), g_strdup(message->args[1]));
+}
+
+/**
+ * The client's reply to "VERSION:": "VERSION:<client version>:<protocol version>"
+ */
+static void handle_version(const TnpMessage* message, gpointer user_data)
+{
+    const TnpClientEvent* event = user_data;
+    TnpClientInfo* info = get_client_info(event->connection);
+
+    // a client registers all of its roots right after accepting the
+    // connection, before it answers VERSION:, so its live ones are complete
+    settle_connection(event->connection);
+    g_free(info->version);
+    info->version = g_strdup(message->args[0]);
+    #ifdef G_ENABLE_DEBUG
+    g_message("Connected to client version %s, protocol %s", message->args[0],
+              message->n_args > 1 ? message->args[1] : "unknown");
+    #endif
+}
+
+// messages handled in the main context, see tnp-protocol.h. Sync roots are
+// maintained by the client's worker thread.
+static const TnpMessageHandler message_handlers[TNP_MESSAGE_N_TYPES] =
+{
+    [TNP_MESSAGE_SHARE]          = handle_share,
+    [TNP_MESSAGE_STATUS]         = handle_status,
+    [TNP_MESSAGE_UPDATE_VIEW]    = handle_update_view,
+    [TNP_MESSAGE_GET_STRINGS]    = handle_get_strings,
+    [TNP_MESSAGE_STRING]         = handle_string,
+    [TNP_MESSAGE_GET_MENU_ITEMS] = handle_menu_items,
+    [TNP_MESSAGE_MENU_ITEM]      = handle_menu_items,
+    [TNP_MESSAGE_VERSION]        = handle_version,
+};
+
+/**
+ * Receives the events of the client's worker thread in batches.
+ */
+static void handle_client_events(TnpClientEvent** events, guint n_events, gpointer user_data)
+{
+    guint i;
+
+    for(i = 0; i < n_events; i++)
+    {
+        switch(events[i]->type)
+        {
+            case TNP_CLIENT_EVENT_MESSAGE:
+                // all other messages can be ignored
+                tnp_message_dispatch(&events[i]->message, message_handlers, events[i]);
+                break;
+            case TNP_CLIENT_EVENT_DISCONNECTED:
+                // statuses are no longer kept up to date by the client; the
+                // caches do not know which client a path belongs to, so the
+                // others' entries are simply requested again
+                tnp_status_cache_clear(session->status_cache);
+                // a restarted client may offer a different menu, and menus
+                // requested from it will not arrive anymore
+                tnp_menu_cache_disconnect(session->menu_cache, events[i]->connection);
+                // replies to outstanding requests are lost with the connection
+                fail_pending_shares(events[i]->connection);
+                // a restarted client sends its strings again
+                g_hash_table_remove(session->clients, GUINT_TO_POINTER(events[i]->connection));
+                settle_connection(events[i]->connection);
+                refresh_pages(NULL);
+                break;
+            case TNP_CLIENT_EVENT_CONNECT_FAILED:
+                // the snapshot does not wait for a client that is not running
+                settle_connection(events[i]->connection);
+                break;
+            case TNP_CLIENT_EVENT_CONNECTED:
+                // ask for the client's version and translated strings
+                tnp_client_send_to(session->client, events[i]->connection, g_strdup(CONNECT_COMMANDS), strlen(CONNECT_COMMANDS));
+                // open pages ask for the statuses they are missing
+                refresh_pages(NULL);
+                break;
+            case TNP_CLIENT_EVENT_SYNCED_DIRS:
+                // cached lookups notice the new sync roots by their generation
+                if(session->snapshot_dirs == NULL)
+                {
+                    schedule_save_snapshot();
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * Send function of the status cache.
+ */
+static gboolean send_to_client(const gchar* data, gsize length, gpointer user_data)
+{
+    return tnp_client_send(session->client, g_strndup(data, length), length);
+}
+
+/**
+ * Send function of the menu cache, which asks the client owning a root.
+ */
+static gboolean send_menu_request(guint connection, const gchar* data, gsize length, gpointer user_data)
+{
+    return tnp_client_send_to(session->client, connection, g_strndup(data, length), length);
+}
+
+/**
+ * Asks the Nextcloud client to share all "paths". The "SHARE:" commands are
+ * handed to the worker thread as a single burst and the replies are matched
+ * back to their paths as they arrive; "callback" is invoked from the main loop
+ * once per path when its reply arrives, the client did not answer in time (see
+ * update_share_timeout()) or the connection is lost.
+ * @param cancellable Drops the callbacks once cancelled, the replies are still
+ *                    consumed so later requests for the same paths match theirs
+ * @return The number of paths whose requests were sent, either all or none.
+ *         The callback is not invoked for the remaining ones.
+ */
+static guint request_shares(GPtrArray* paths, TnpShareCallback callback, gpointer user_data, GCancellable* cancellable)
+{
+    GString* burst;
+    gsize length;
+    guint i, sent;
+    GQueue* queue;
+    TnpPendingShare* pending;
+    TnpPathHandle handle;
+
+    if(paths->len == 0 || !tnp_client_is_connected(session->client))
+    {
+        return 0;
+    }
+    // build all commands at once
+    burst = g_string_new(NULL);
+    for(i = 0; i < paths->len; i++)
+    {
+        g_string_append(burst, "SHARE:");
+        g_string_append(burst, g_ptr_array_index(paths, i));
+        g_string_append_c(burst, '\n');
+    }
+    length = burst->len;
+    if(!tnp_client_send(session->client, g_string_free(burst, FALSE), length))
+    {
+        return 0;
+    }
+    for(sent = 0; sent < paths->len; sent++)
+    {
+        handle = tnp_path_arena_intern(session->path_arena, g_ptr_array_index(paths, sent));
+        queue = g_hash_table_lookup(session->pending_shares, TNP_PATH_HANDLE_TO_POINTER(handle));
+        if(queue == NULL)
+        {
+            queue = g_queue_new();
+            g_hash_table_insert(session->pending_shares, TNP_PATH_HANDLE_TO_POINTER(handle), queue);
+        }
+        else
+        {
+            // the existing key already holds a reference
+            tnp_path_arena_unref(session->path_arena, handle);
+        }
+        pending = g_new(TnpPendingShare, 1);
+        pending->callback = callback;
+        pending->user_data = user_data;
+        pending->cancellable = cancellable != NULL ? g_object_ref(cancellable) : NULL;
+        pending->path = handle;
+        // the worker routes the request the same way
+        pending->connection = TNP_CLIENT_CONNECTION_ANY;
+        tnp_path_index_lookup_owner(get_synced_dirs(), g_ptr_array_index(paths, sent), &pending->connection);
+        pending->sent = g_get_monotonic_time();
+        pending->expired = FALSE;
+        pending->start = tnp_stats_start();
+        g_queue_push_tail(queue, pending);
+    }
+    session->waiting_shares += sent;
+    update_share_timeout(FALSE);
+    return sent;
+}
+
+/**
+ * State of one activation of the "Share" menu item, which may cover several
+ * files.
+ */
+typedef struct
+{
+    // weak pointer to the window the item was activated in
+    GtkWidget* window;
+    guint      total;
+    guint      remaining;
+    GPtrArray* failed;
+} TnpShareBatch;
+
+/**
+ * Reports all failures of a finished batch in one dialog and frees it.
+ */
+static void tnp_share_batch_finish(TnpShareBatch* batch)
+{
+    GtkWidget* dialog;
+    GString* details;
+    guint i;
+
+    // nobody is interested in failures while Thunar shuts down
+    if(batch->failed->len > 0 && !session->stopping)
+    {
+        details = g_string_new(NULL);
+        if(batch->failed->len == 1)
+        {
+            g_string_append_printf(details, "Failed to share the path '%s'.", (gchar*) g_ptr_array_index(batch->failed, 0));
+        }
+        else
+        {
+            g_string_append_printf(details, "Failed to share %u of %u paths:", batch->failed->len, batch->total);
+            // keep the dialog at a sane size
+            for(i = 0; i < batch->failed->len && i < 10; i++)
+            {
+                g_string_append_printf(details, "\n%s", (gchar*) g_ptr_array_index(batch->failed, i));
+            }
+            if(i < batch->failed->len)
+            {
+                g_string_append_printf(details, "\n... and %u more", batch->failed->len - i);
+            }
+        }
+        /* display an error dialog without blocking the main loop */
+        dialog = gtk_message_dialog_new (batch->window != NULL ? GTK_WINDOW (batch->window) : NULL,
+                                         GTK_DIALOG_DESTROY_WITH_PARENT,
+                                         GTK_MESSAGE_ERROR,
+                                         GTK_BUTTONS_CLOSE,
+                                         batch->failed->len == 1 ? "Failed to share item" : "Failed to share items");
+        gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (dialog), "%s", details->str);
+        g_signal_connect (dialog, "response", G_CALLBACK (gtk_widget_destroy), NULL);
+        gtk_widget_show (dialog);
+        g_string_free(details, TRUE);
+    }
+    if(batch->window != NULL)
+    {
+        g_object_remove_weak_pointer(G_OBJECT(batch->window), (gpointer*) &batch->window);
+    }
+    g_ptr_array_free(batch->failed, TRUE);
+    g_slice_free(TnpShareBatch, batch);
+}
+
+/**
+ * Completion callback for every path shared through the "Share" menu item.
+ */
+static void tnp_share_item_done(const gchar* path, gboolean success, gpointer user_data)
+{
+    TnpShareBatch* batch = user_data;
+
+    if(!success)
+    {
+        g_ptr_array_add(batch->failed, g_strdup(path));
+    }
+    if(--batch->remaining == 0)
+    {
+        tnp_share_batch_finish(batch);
+    }
+}
+
+/**
+ * Determines the canonical path of "file_info" inside the directory with the
+ * canonical path "parent". Only symbolic links need to be resolved with
+ * realpath().
+ * @return FALSE if the path could not be resolved
+ */
+static gboolean resolve_child(ThunarxFileInfo* file_info, const gchar* parent, char buffer[PATH_MAX])
+{
+    gchar* uri;
+    gchar* filename;
+    gchar* name;
+    GFileInfo* info;
+    gboolean is_symlink;
+    gboolean ret = TRUE;
+    gint64 start;
+
+    info = thunarx_file_info_get_file_info(file_info);
+    is_symlink = info != NULL && g_file_info_get_is_symlink(info);
+    if(info != NULL)
+    {
+        g_object_unref(info);
+    }
+    if(is_symlink)
+    {
+        uri = thunarx_file_info_get_uri(file_info);
+        filename = g_filename_from_uri(uri, NULL, NULL);
+        g_free(uri);
+        start = tnp_stats_start();
+        ret = filename != NULL && realpath(filename, buffer) != NULL;
+        tnp_stats_record(TNP_STATS_REALPATH, start);
+        #ifdef G_ENABLE_DEBUG
+        if(!ret)
+            g_message("Failed to resolve path '%s'", filename);
+        #endif
+        g_free(filename);
+    }
+    else
+    {
+        name = thunarx_file_info_get_name(file_info);
+        ret = g_snprintf(buffer, PATH_MAX, "%s/%s", strcmp(parent, "/") == 0 ? "" : parent, name) < PATH_MAX;
+        g_free(name);
+    }
+    return ret;
+}
+
+/**
+ * Determines the canonical path of "file_info". The parent directory comes from
+ * the path cache, see resolve_child().
+ * @param root Set to the sync root containing the parent directory or NULL
+ * @return FALSE if the path could not be resolved
+ */
+static gboolean resolve_file(ThunarxFileInfo* file_info, char buffer[PATH_MAX], const gchar** root)
+{
+    gchar* uri;
+    const gchar* parent;
+
+    uri = thunarx_file_info_get_parent_uri(file_info);
+    parent = tnp_path_cache_lookup(session->path_cache, uri, get_synced_dirs(), root);
+    g_free(uri);
+    return parent != NULL && resolve_child(file_info, parent, buffer);
+}
+
+static void tnp_share_item(ThunarxMenuItem *item, GtkWidget* window)
+{
+    GList* files;
+    GList* lp;
+    const gchar* root;
+    char realpath_buffer[PATH_MAX];
+    GPtrArray* paths;
+    TnpShareBatch* batch;
+    guint i, sent;
+    gchar* uri;
+
+    /* determine the files associated with the action */
+    files = g_object_get_qdata (G_OBJECT (item), tnp_item_files_quark);
+    if (G_UNLIKELY (files == NULL))
+    {
+        return;
+    }
+
+    batch = g_slice_new0(TnpShareBatch);
+    batch->failed = g_ptr_array_new_with_free_func(g_free);
+    // the window may be closed before the replies arrive
+    batch->window = window;
+    g_object_add_weak_pointer(G_OBJECT(window), (gpointer*) &batch->window);
+
+    // get the files' paths, the client cannot share what is no longer synced
+    // since the menu was built
+    paths = g_ptr_array_new_with_free_func(g_free);
+    for(lp = files; lp != NULL; lp = lp->next)
+    {
+        batch->total++;
+        if(resolve_file(lp->data, realpath_buffer, &root) && root != NULL)
+        {
+            g_ptr_array_add(paths, g_strdup(realpath_buffer));
+        }
+        else
+        {
+            uri = thunarx_file_info_get_uri(lp->data);
+            g_ptr_array_add(batch->failed, g_filename_display_name(uri));
+            g_free(uri);
+        }
+    }
+
+    // send all requests in one burst, the batch finishes with the last reply
+    sent = request_shares(paths, tnp_share_item_done, batch, NULL);
+    for(i = sent; i < paths->len; i++)
+    {
+        g_ptr_array_add(batch->failed, g_strdup(g_ptr_array_index(paths, i)));
+    }
+    g_ptr_array_free(paths, TRUE);
+    batch->remaining = sent;
+    if(sent == 0)
+    {
+        tnp_share_batch_finish(batch);
+    }
+}
+
+/**
+ * Runs a command of the client's menu for the files of "item".
+ */
+static void tnp_client_menu_item(ThunarxMenuItem* item, GtkWidget* window)
+{
+    GList* files;
+    GList* lp;
+    const gchar* command;
+    const gchar* root;
+    char realpath_buffer[PATH_MAX];
+    GString* line;
+
+    command = g_object_get_qdata(G_OBJECT(item), tnp_item_command_quark);
+    files = g_object_get_qdata(G_OBJECT(item), tnp_item_files_quark);
+    if(G_UNLIKELY(command == NULL || files == NULL))
+    {
+        return;
+    }
+    // sharing reports its result, so use the same requests as the static item
+    if(strcmp(command, "SHARE") == 0)
+    {
+        tnp_share_item(item, window);
+        return;
+    }
+    line = g_string_new(command);
+    g_string_append_c(line, ':');
+    for(lp = files; lp != NULL; lp = lp->next)
+    {
+        if(!resolve_file(lp->data, realpath_buffer, &root))
+        {
+            g_string_free(line, TRUE);
+            return;
+        }
+        if(lp != files)
+        {
+            g_string_append(line, TNP_MENU_PATH_SEPARATOR);
+        }
+        g_string_append(line, realpath_buffer);
+    }
+    g_string_append_c(line, '\n');
+    send_to_client(line->str, line->len, NULL);
+    g_string_free(line, TRUE);
+}
+
+/**
+ * Creates a menu item acting on "files", which calls "callback" when activated.
+ */
+static ThunarxMenuItem* new_menu_item(TnpProvider* tnp_provider,
+                                      GtkWidget* window,
+                                      GList* files,
+                                      const gchar* name,
+                                      const gchar* label,
+                                      const gchar* tooltip,
+                                      GCallback callback)
+{
+    ThunarxMenuItem* item;
+    GClosure* closure;
+
+    item = thunarx_menu_item_new(name, label, tooltip, "Nextcloud");
+
+    g_object_set_qdata_full (G_OBJECT (item), tnp_item_files_quark, 
+                             thunarx_file_info_list_copy (files),
+                             (GDestroyNotify) thunarx_file_info_list_free);
+
+    g_object_set_qdata_full (G_OBJECT (item), tnp_item_provider_quark,
+                             g_object_ref (G_OBJECT (tnp_provider)),
+                             (GDestroyNotify) g_object_unref);
+
+    closure = g_cclosure_new_object (callback, G_OBJECT (window));
+
+    g_signal_connect_closure (G_OBJECT (item), "activate", closure, TRUE);
+
+    return item;
+}
+
+/**
+ * Builds a "Nextcloud" submenu from the menu the client offers for "files".
+ */
+static ThunarxMenuItem* build_client_menu(TnpProvider* tnp_provider,
+                                          GtkWidget* window,
+                                          GList* files,
+                                          guint connection,
+                                          const GPtrArray* actions)
+{
+    ThunarxMenuItem* parent;
+    ThunarxMenuItem* item;
+    ThunarxMenu* menu;
+    const TnpMenuAction* action;
+    const gchar* title;
+    gchar* name;
+    guint i;
+
+    title = get_client_string(connection, "CONTEXT_MENU_TITLE");
+    parent = thunarx_menu_item_new("Tnp::menu", title != NULL ? title : "Nextcloud", NULL, "Nextcloud");
+    menu = thunarx_menu_new();
+    for(i = 0; i < actions->len; i++)
+    {
+        action = g_ptr_array_index(actions, i);
+        name = g_strconcat("Tnp::", action->command, NULL);
+        item = new_menu_item(tnp_provider, window, files, name, action->text, NULL,
+                             G_CALLBACK(tnp_client_menu_item));
+        g_object_set_qdata_full(G_OBJECT(item), tnp_item_command_quark, g_strdup(action->command), g_free);
+        // disabled items are shown like the client does
+        thunarx_menu_item_set_sensitive(item, strchr(action->flags, 'd') == NULL);
+        thunarx_menu_append_item(menu, item);
+        g_object_unref(item);
+        g_free(name);
+    }
+    thunarx_menu_item_set_menu(parent, menu);
+    g_object_unref(menu);
+    return parent;
+}
+
+static void menu_memo_free(gpointer data)
+{
+    TnpMenuMemo* memo = data;
+    g_free(memo->parent_uri);
+    tnp_path_arena_unref(session->path_arena, memo->parent);
+    g_slice_free(TnpMenuMemo, memo);
+}
+
+/**
+ * Returns what an earlier menu found out about selections of "kind" in the
+ * directory "uri", or resolves the directory if nothing is known. The last
+ * MENU_MEMO_SIZE results are kept while the sync roots are unchanged and the
+ * path cache still watches their directories, so selecting one item after
+ * another in a big folder is answered from memory.
+ * @return The memo (valid until the next call) or NULL if "uri" is not local
+ *         or cannot be resolved
+ */
+static TnpMenuMemo* menu_memo_lookup(const gchar* uri, TnpMenuKind kind)
+{
+    const TnpPathIndex* synced_dirs = get_synced_dirs();
+    TnpMenuMemo* memo;
+    const gchar* parent;
+    const gchar* root;
+    GList* link;
+
+    for(link = session->menu_memo.head; link != NULL; link = link->next)
+    {
+        memo = link->data;
+        if(memo->kind == kind && strcmp(memo->parent_uri, uri) == 0)
+        {
+            break;
+        }
+    }
+    if(link != NULL)
+    {
+        g_queue_unlink(&session->menu_memo, link);
+        if(memo->roots_generation == tnp_path_index_generation(synced_dirs) &&
+           memo->paths_generation == tnp_path_cache_get_generation(session->path_cache))
+        {
+            g_queue_push_head_link(&session->menu_memo, link);
+            return memo;
+        }
+        g_list_free_1(link);
+        menu_memo_free(memo);
+    }
+
+    parent = tnp_path_cache_lookup(session->path_cache, uri, synced_dirs, &root);
+    if(parent == NULL)
+    {
+        return NULL;
+    }
+    memo = g_slice_new0(TnpMenuMemo);
+    memo->parent_uri = g_strdup(uri);
+    memo->kind = kind;
+    memo->parent = tnp_path_arena_intern(session->path_arena, parent);
+    memo->root = root;
+    memo->roots_generation = tnp_path_index_generation(synced_dirs);
+    memo->paths_generation = tnp_path_cache_get_generation(session->path_cache);
+    g_queue_push_head(&session->menu_memo, memo);
+    if(session->menu_memo.length > MENU_MEMO_SIZE)
+    {
+        menu_memo_free(g_queue_pop_tail(&session->menu_memo));
+    }
+    return memo;
+}
+
+static GList* build_file_menu_items(TnpProvider* tnp_provider, GtkWidget* window, GList* files)
+{
+    gchar* uri;
+    const gchar* root;
+    char* tooltip_name_dir = "Share the selected directory via Nextcloud";
+    char* tooltip_name_file = "Share the selected file via Nextcloud";
+    char* tooltip_name_multiple = "Share the selected items via Nextcloud";
+    char* tooltip = tooltip_name_dir;
+    GList* lp;
+    const gchar* parent;
+    const gchar* memo_parent;
+    char realpath_buffer[PATH_MAX];
+    GPtrArray* paths = NULL;
+    const GPtrArray* actions = NULL;
+    TnpMenuKind kind;
+    TnpMenuMemo* memo;
+    guint connection = TNP_CLIENT_CONNECTION_ANY;
+
+    ThunarxMenuItem *item = NULL;
+    GList* items = NULL;
+
+    if(files->next != NULL)
+    {
+        kind = TNP_MENU_KIND_MULTIPLE;
+    }
+    else
+    {
+        kind = thunarx_file_info_is_directory(files->data) ? TNP_MENU_KIND_DIRECTORY : TNP_MENU_KIND_FILE;
+    }
+    // the client's worker thread keeps the list of synced dirs up to date, so
+    // only the published snapshot is used here and a missing client costs nothing
+
+    // the items must be local and direct descendants of a synced directory,
+    // i.e. their parent is either a synced dir or a descendant; the directory
+    // of the first item was usually seen by one of the last menus
+    uri = thunarx_file_info_get_parent_uri(files->data);
+    memo = menu_memo_lookup(uri, kind);
+    g_free(uri);
+    if(memo == NULL || memo->root == NULL)
+    {
+        return NULL;
+    }
+    memo_parent = tnp_path_arena_get(session->path_arena, memo->parent);
+    tnp_status_cache_request(session->status_cache, memo_parent, TRUE);
+
+    // the client's menu is cached for the root of the first item, the paths
+    // are only needed for fetching it
+    if(tnp_client_is_connected(session->client) &&
+       (memo->actions == NULL || memo->menus_generation != tnp_menu_cache_get_generation(session->menu_cache)))
+    {
+        paths = g_ptr_array_new_with_free_func(g_free);
+    }
+    // warm up the status cache for the selection, sent in one batch later
+    for(lp = files; lp != NULL; lp = lp->next)
+    {
+        parent = memo_parent;
+        if(lp != files)
+        {
+            // the other items are usually in the same directory
+            uri = thunarx_file_info_get_parent_uri(lp->data);
+            if(strcmp(uri, memo->parent_uri) != 0)
+            {
+                parent = tnp_path_cache_lookup(session->path_cache, uri, get_synced_dirs(), &root);
+                if(parent == NULL || root == NULL)
+                {
+                    g_free(uri);
+                    if(paths != NULL)
+                    {
+                        g_ptr_array_free(paths, TRUE);
+                    }
+                    return NULL;
+                }
+                tnp_status_cache_request(session->status_cache, parent, TRUE);
+            }
+            g_free(uri);
+        }
+        if(resolve_child(lp->data, parent, realpath_buffer))
+        {
+            tnp_status_cache_request(session->status_cache, realpath_buffer, thunarx_file_info_is_directory(lp->data));
+            track_file_info(lp->data, realpath_buffer);
+            if(paths != NULL)
+            {
+                g_ptr_array_add(paths, g_strdup(realpath_buffer));
+            }
+        }
+    }
+
+    // use the client's menu if it is known, otherwise it is fetched for next time
+    if(paths != NULL)
+    {
+        // only a connected client that registered the root can answer
+        if(paths->len > 0 &&
+           tnp_path_index_lookup_owner(tnp_client_get_synced_dirs(session->client), memo->root, &connection) != NULL)
+        {
+            memo->actions = tnp_menu_cache_lookup(session->menu_cache, memo->root, connection, kind, paths);
+            memo->menus_generation = tnp_menu_cache_get_generation(session->menu_cache);
+        }
+        g_ptr_array_free(paths, TRUE);
+    }
+    if(tnp_client_is_connected(session->client) &&
+       memo->menus_generation == tnp_menu_cache_get_generation(session->menu_cache))
+    {
+        actions = memo->actions;
+    }
+    if(actions != NULL && actions->len > 0)
+    {
+        // titled like the client owning the root calls it
+        tnp_path_index_lookup_owner(get_synced_dirs(), memo->root, &connection);
+        return g_list_append(items, build_client_menu(tnp_provider, window, files, connection, actions));
+    }
+
+    // select the correct tooltip
+    if(files->next != NULL)
+    {
+        tooltip = tooltip_name_multiple;
+    }
+    else if(!thunarx_file_info_is_directory(files->data))
+    {
+        tooltip = tooltip_name_file;
+    }
+    // append the "Share" action
+    item = new_menu_item(tnp_provider, window, files, "Tnp::share", _("Share via _Nextcloud"), tooltip,
+                         G_CALLBACK(tnp_share_item));
+
+    items = g_list_append (items, item);
+    return items;
+}
+
+/**
+ * Describes a sync status for the property page.
+ */
+static const gchar* describe_status(TnpSyncStatus status)
+{
+    switch(status)
+    {
+        case TNP_SYNC_STATUS_OK:
+            return _("Up to date");
+        case TNP_SYNC_STATUS_SYNC:
+            return _("Syncing");
+        case TNP_SYNC_STATUS_NEW:
+            return _("Not uploaded yet");
+        case TNP_SYNC_STATUS_IGNORE:
+            return _("Excluded from syncing");
+        case TNP_SYNC_STATUS_ERROR:
+            return _("Sync error");
+        case TNP_SYNC_STATUS_NOP:
+            return _("Not synced");
+        default:
+            return _("Unknown");
+    }
+}
+
+/**
+ * Fills the page from the caches, asking the client for what is missing. This
+ * never waits for the client: its replies trigger another refresh.
+ */
+static void tnp_page_refresh(TnpPage* page)
+{
+    TnpSyncStatus status;
+    gboolean shared;
+    gboolean connected;
+    guint n_errors, n_syncing;
+    GString* text;
+
+    // cancelled with the session as well
+    if(g_cancellable_is_cancelled(page->cancellable))
+    {
+        return;
+    }
+    connected = tnp_client_is_connected(session->client);
+
+    status = tnp_status_cache_get(session->status_cache, page->path, &shared);
+    if(status == TNP_SYNC_STATUS_UNKNOWN && connected)
+    {
+        tnp_status_cache_request(session->status_cache, page->path, page->is_directory);
+    }
+    text = g_string_new(connected || status != TNP_SYNC_STATUS_UNKNOWN ?
+                        describe_status(status) : _("Not connected to the Nextcloud client"));
+    if(page->is_directory)
+    {
+        // only covers the files whose status is known, e.g. shown in a view
+        n_errors = tnp_status_cache_count(session->status_cache, page->path, TNP_SYNC_STATUS_ERROR);
+        n_syncing = tnp_status_cache_count(session->status_cache, page->path, TNP_SYNC_STATUS_SYNC);
+        if(n_errors > 0)
+        {
+            g_string_append_printf(text, _(", %u items with errors"), n_errors);
+        }
+        if(n_syncing > 0)
+        {
+            g_string_append_printf(text, _(", %u items syncing"), n_syncing);
+        }
+    }
+    gtk_label_set_text(GTK_LABEL(page->status_label), text->str);
+    g_string_free(text, TRUE);
+
+    if(page->sharing)
+    {
+        gtk_label_set_text(GTK_LABEL(page->share_label), _("Waiting for the Nextcloud client..."));
+    }
+    else if(page->share_failed)
+    {
+        gtk_label_set_text(GTK_LABEL(page->share_label), _("Failed to share"));
+    }
+    else if(status == TNP_SYNC_STATUS_UNKNOWN)
+    {
+        gtk_label_set_text(GTK_LABEL(page->share_label), _("Unknown"));
+    }
+    else
+    {
+        gtk_label_set_text(GTK_LABEL(page->share_label), shared ? _("Shared") : _("Not shared"));
+    }
+    gtk_widget_set_sensitive(page->share_button, connected && !page->sharing);
+    gtk_widget_set_sensitive(page->copy_link_button, connected);
+    gtk_widget_set_sensitive(page->open_link_button, connected);
+}
+
+static gboolean tnp_page_refresh_idle(gpointer user_data)
+{
+    TnpPage* page = user_data;
+
+    page->refresh_id = 0;
+    tnp_page_refresh(page);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Refreshes the open pages showing "path" or a directory above it, or all of
+ * them if "path" is NULL. A burst of status replies causes one refresh.
+ */
+static void refresh_pages(const gchar* path)
+{
+    GList* lp;
+    TnpPage* page;
+    gsize length;
+
+    for(lp = session->open_pages; lp != NULL; lp = lp->next)
+    {
+        page = lp->data;
+        if(path != NULL && strcmp(path, page->path) != 0)
+        {
+            length = strlen(page->path);
+            if(!page->is_directory || strncmp(path, page->path, length) != 0 || path[length] != '/')
+            {
+                continue;
+            }
+        }
+        if(page->refresh_id == 0)
+        {
+            page->refresh_id = g_idle_add(tnp_page_refresh_idle, page);
+        }
+    }
+}
+
+/**
+ * Completion callback of the page's share request. It is not invoked after
+ * the page was destroyed.
+ */
+static void tnp_page_share_done(const gchar* path, gboolean success, gpointer user_data)
+{
+    TnpPage* page = user_data;
+
+    page->sharing = FALSE;
+    page->share_failed = !success;
+    tnp_page_refresh(page);
+}
+
+static void tnp_page_share_clicked(GtkButton* button, TnpPage* page)
+{
+    GPtrArray* paths;
+
+    if(g_cancellable_is_cancelled(page->cancellable))
+    {
+        return;
+    }
+    paths = g_ptr_array_new();
+    g_ptr_array_add(paths, page->path);
+    page->sharing = request_shares(paths, tnp_page_share_done, page, page->cancellable) > 0;
+    page->share_failed = !page->sharing;
+    g_ptr_array_free(paths, TRUE);
+    tnp_page_refresh(page);
+}
+
+/**
+ * The client copies or opens the link itself, nothing to wait for.
+ */
+static void tnp_page_send_command(TnpPage* page, const gchar* command)
+{
+    gchar* line;
+
+    if(g_cancellable_is_cancelled(page->cancellable))
+    {
+        return;
+    }
+    line = g_strconcat(command, ":", page->path, "\n", NULL);
+    send_to_client(line, strlen(line), NULL);
+    g_free(line);
+}
+
+static void tnp_page_copy_link_clicked(GtkButton* button, TnpPage* page)
+{
+    tnp_page_send_command(page, "COPY_PRIVATE_LINK");
+}
+
+static void tnp_page_open_link_clicked(GtkButton* button, TnpPage* page)
+{
+    tnp_page_send_command(page, "OPEN_PRIVATE_LINK");
+}
+
+/**
+ * The dialog was closed or shows other files now: replies still on their way
+ * are consumed without touching the page.
+ */
+static void tnp_page_destroyed(GtkWidget* widget, TnpPage* page)
+{
+    g_cancellable_cancel(page->cancellable);
+    g_object_unref(page->cancellable);
+    if(page->refresh_id != 0)
+    {
+        g_source_remove(page->refresh_id);
+    }
+    // the session may have been torn down before the dialog
+    if(session != NULL)
+    {
+        session->open_pages = g_list_remove(session->open_pages, page);
+    }
+    g_free(page->path);
+    g_slice_free(TnpPage, page);
+}
+
+/**
+ * Adds a row with a bold "title" to the page's grid.
+ * @return The label holding the row's value
+ */
+static GtkWidget* tnp_page_add_row(GtkWidget* grid, gint row, const gchar* title, const gchar* value)
+{
+    GtkWidget* label;
+    gchar* markup;
+
+    label = gtk_label_new(NULL);
+    markup = g_markup_printf_escaped("<b>%s</b>", title);
+    gtk_label_set_markup(GTK_LABEL(label), markup);
+    g_free(markup);
+    gtk_label_set_xalign(GTK_LABEL(label), 1.0);
+    gtk_grid_attach(GTK_GRID(grid), label, 0, row, 1, 1);
+
+    label = gtk_label_new(value);
+    gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+    gtk_label_set_selectable(GTK_LABEL(label), TRUE);
+    gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_MIDDLE);
+    gtk_widget_set_hexpand(label, TRUE);
+    gtk_grid_attach(GTK_GRID(grid), label, 1, row, 1, 1);
+    return label;
+}
+
+/**
+ * Creates the "Nextcloud" page for the file at the canonical "path" in the
+ * sync root "root".
+ */
+static GtkWidget* tnp_page_new(const gchar* path, const gchar* root, gboolean is_directory)
+{
+    TnpPage* page;
+    GtkWidget* grid;
+    GtkWidget* box;
+    gchar* display_root;
+
+    page = g_slice_new0(TnpPage);
+    page->path = g_strdup(path);
+    page->is_directory = is_directory;
+    page->cancellable = g_cancellable_new();
+    page->page = thunarx_property_page_new(_("Nextcloud"));
+
+    grid = gtk_grid_new();
+    gtk_grid_set_row_spacing(GTK_GRID(grid), 6);
+    gtk_grid_set_column_spacing(GTK_GRID(grid), 12);
+    gtk_container_set_border_width(GTK_CONTAINER(grid), 12);
+    page->status_label = tnp_page_add_row(grid, 0, _("Sync status:"), NULL);
+    page->share_label = tnp_page_add_row(grid, 1, _("Sharing:"), NULL);
+    display_root = g_filename_display_name(root);
+    tnp_page_add_row(grid, 2, _("Synced folder:"), display_root);
+    g_free(display_root);
+
+    box = gtk_button_box_new(GTK_ORIENTATION_HORIZONTAL);
+    gtk_button_box_set_layout(GTK_BUTTON_BOX(box), GTK_BUTTONBOX_START);
+    gtk_box_set_spacing(GTK_BOX(box), 6);
+    page->share_button = gtk_button_new_with_mnemonic(_("_Share..."));
+    g_signal_connect(page->share_button, "clicked", G_CALLBACK(tnp_page_share_clicked), page);
+    gtk_container_add(GTK_CONTAINER(box), page->share_button);
+    page->copy_link_button = gtk_button_new_with_mnemonic(_("_Copy private link"));
+    g_signal_connect(page->copy_link_button, "clicked", G_CALLBACK(tnp_page_copy_link_clicked), page);
+    gtk_container_add(GTK_CONTAINER(box), page->copy_link_button);
+    page->open_link_button = gtk_button_new_with_mnemonic(_("_Open in browser"));
+    g_signal_connect(page->open_link_button, "clicked", G_CALLBACK(tnp_page_open_link_clicked), page);
+    gtk_container_add(GTK_CONTAINER(box), page->open_link_button);
+    gtk_grid_attach(GTK_GRID(grid), box, 0, 3, 2, 1);
+
+    gtk_container_add(GTK_CONTAINER(page->page), grid);
+    gtk_widget_show_all(grid);
+    g_signal_connect(page->page, "destroy", G_CALLBACK(tnp_page_destroyed), page);
+
+    session->open_pages = g_list_prepend(session->open_pages, page);
+    // whatever is cached is shown right away
+    tnp_page_refresh(page);
+    return page->page;
+}
+
+/**
+ * Creates the caches and connects to the clients. This is deferred from
+ * plugin loading so that it does not delay Thunar's first window: it runs
+ * from a low priority idle callback or on the first menu request, whichever
+ * comes first.
+ */
+static void start_client()
+{
+    gint64 start;
+
+    if(session->client != NULL)
+    {
+        return;
+    }
+    if(session->start_id != 0)
+    {
+        g_source_remove(session->start_id);
+        session->start_id = 0;
+    }
+    start = tnp_stats_start();
+    session->path_arena = tnp_path_arena_new();
+    session->path_cache = tnp_path_cache_new(PATH_CACHE_SIZE, session->path_arena);
+    session->status_cache = tnp_status_cache_new(session->path_arena, send_to_client, status_changed, NULL);
+    session->menu_cache = tnp_menu_cache_new(send_menu_request, NULL);
+    session->pending_shares = pending_shares_new();
+    session->share_rtt = tnp_rtt_new(SHARE_TIMEOUT_INITIAL, SHARE_TIMEOUT_MIN, SHARE_TIMEOUT_MAX);
+    session->file_infos = g_hash_table_new(g_direct_hash, g_direct_equal);
+    session->clients = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, client_info_free);
+    session->unsettled = g_hash_table_new(g_direct_hash, g_direct_equal);
+    load_snapshot();
+    /* connect to the sockets, retrying in the background if that fails */
+    session->client = tnp_client_new(handle_client_events, NULL);
+    discover_sockets();
+    tnp_stats_record(TNP_STATS_CLIENT_START, start);
+}
+
+static gboolean start_client_idle(gpointer user_data)
+{
+    session->start_id = 0;
+    start_client();
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Returns a new reference to the session, creating it if necessary. A new
+ * session connects once Thunar is idle, so loading the plugin stays cheap.
+ */
+static TnpSession* session_ref()
+{
+    if(session == NULL)
+    {
+        session = g_slice_new0(TnpSession);
+        // the plugin's reference, see tnp_provider_shutdown()
+        session->ref_count = 1;
+        session->start_id = g_idle_add_full(G_PRIORITY_LOW, start_client_idle, NULL, NULL);
+    }
+    session->ref_count++;
+    return session;
+}
+
+/**
+ * Closes the connections and frees all state. Requests still waiting for a
+ * reply fail without reporting it, open property pages stop refreshing.
+ */
+static void session_free()
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    GList* lp;
+    TnpPage* page;
+
+    session->stopping = TRUE;
+    if(session->start_id != 0)
+    {
+        g_source_remove(session->start_id);
+    }
+    if(session->snapshot_expire_id != 0)
+    {
+        g_source_remove(session->snapshot_expire_id);
+    }
+    if(session->snapshot_save_id != 0)
+    {
+        g_source_remove(session->snapshot_save_id);
+    }
+    // pages that outlive the session are left alone
+    for(lp = session->open_pages; lp != NULL; lp = lp->next)
+    {
+        page = lp->data;
+        g_cancellable_cancel(page->cancellable);
+        if(page->refresh_id != 0)
+        {
+            g_source_remove(page->refresh_id);
+            page->refresh_id = 0;
+        }
+    }
+    g_list_free(session->open_pages);
+    session->open_pages = NULL;
+    // joins the worker thread and closes the sockets, no more events arrive
+    tnp_client_free(session->client);
+    if(session->pending_shares != NULL)
+    {
+        fail_pending_shares(TNP_CLIENT_CONNECTION_ANY);
+        g_hash_table_destroy(session->pending_shares);
+        tnp_rtt_free(session->share_rtt);
+    }
+    if(session->file_infos != NULL)
+    {
+        // the infos may outlive the plugin's code
+        g_hash_table_iter_init(&iter, session->file_infos);
+        while(g_hash_table_iter_next(&iter, &key, &value))
+        {
+            g_object_weak_unref(value, file_info_finalized, key);
+            tnp_path_arena_unref(session->path_arena, TNP_POINTER_TO_PATH_HANDLE(key));
+        }
+        g_hash_table_destroy(session->file_infos);
+    }
+    if(session->socket_monitors != NULL)
+    {
+        g_hash_table_destroy(session->socket_monitors);
+    }
+    socket_monitor_free(session->runtime_monitor);
+    if(session->menu_cache != NULL)
+    {
+        g_queue_foreach(&session->menu_memo, (GFunc) menu_memo_free, NULL);
+        g_queue_clear(&session->menu_memo);
+        tnp_menu_cache_free(session->menu_cache);
+        tnp_status_cache_free(session->status_cache);
+        tnp_path_cache_free(session->path_cache);
+        tnp_path_arena_free(session->path_arena);
+        g_hash_table_destroy(session->clients);
+        g_hash_table_destroy(session->unsettled);
+    }
+    tnp_path_index_free(session->snapshot_dirs);
+    g_slice_free(TnpSession, session);
+    session = NULL;
+}
+
+static void session_unref()
+{
+    if(--session->ref_count == 0)
+    {
+        session_free();
+    }
+}
+
+/**
+ * Drops the plugin's reference to the session, which is torn down once the
+ * last provider is gone. Called from thunar_extension_shutdown().
+ */
+void tnp_provider_shutdown()
+{
+    if(session != NULL)
+    {
+        session_unref();
+    }
+}
+
+static GList* tnp_provider_get_file_menu_items(ThunarxMenuProvider* menu_provider,
+                                            GtkWidget* window,
+                                            GList* files)
+{
+    gint64 start = tnp_stats_start();
+    GList* items;
+
+    // the first request may come before the idle callback
+    start_client();
+    items = build_file_menu_items(TNP_PROVIDER(menu_provider), window, files);
+    tnp_stats_record(TNP_STATS_MENU_BUILD, start);
+    return items;
+}
+
+/**
+ * Offers the "Nextcloud" page for a single file in a sync root. The page is
+ * created from cached data, so the dialog opens without waiting for the client.
+ */
+static GList* tnp_provider_get_pages(ThunarxPropertyPageProvider* page_provider, GList* files)
+{
+    gchar* uri_scheme;
+    gboolean local;
+    const gchar* root;
+    char realpath_buffer[PATH_MAX];
+
+    start_client();
+    if(files == NULL || files->next != NULL)
+    {
+        return NULL;
+    }
+    uri_scheme = thunarx_file_info_get_uri_scheme(files->data);
+    local = strcmp(uri_scheme, "file") == 0;
+    g_free(uri_scheme);
+    if(!local || !resolve_file(files->data, realpath_buffer, &root) || root == NULL)
+    {
+        return NULL;
+    }
+    return g_list_append(NULL, tnp_page_new(realpath_buffer, root, thunarx_file_info_is_directory(files->data)));
+}
+
+
+
+
+
+
+
+
+
+
+/**
+ * No idea what these do
+ */
+static void tnp_provider_class_init(TnpProviderClass* classname)
+{
+    GObjectClass* gobject_class;
+
+    /* determine the "tnp-item-files", "tnp-item-folder" and "tnp-item-provider" quarks */
+    tnp_item_files_quark = g_quark_from_string("tnp-item-files");
     #if THUNARX_CHECK_VERSION(0,4,1)
     tnp_item_folder_quark = g_quark_from_string("tnp-item-folder");
     #endif
     tnp_item_provider_quark = g_quark_from_string("tnp-item-provider");
+    tnp_item_command_quark = g_quark_from_string("tnp-item-command");
 
     gobject_class = G_OBJECT_CLASS(classname);
     gobject_class->finalize = tnp_provider_finalize;
@@ -499,10 +2078,15 @@ static void tnp_provider_menu_provider_init(ThunarxMenuProviderIface* iface)
     iface->get_file_menu_items = tnp_provider_get_file_menu_items;
 }
 
+static void tnp_provider_property_page_provider_init(ThunarxPropertyPageProviderIface* iface)
+{
+    iface->get_pages = tnp_provider_get_pages;
+}
+
 static void tnp_provider_init(TnpProvider* tnp_provider)
 {
-    /* connect to the socket */
-    connect_socket();
+    // all providers share one session, see TnpSession
+    tnp_provider->session = session_ref();
 }
 
 static void tnp_provider_finalize(GObject* object)
@@ -520,6 +2104,9 @@ static void tnp_provider_finalize(GObject* object)
         source = g_main_context_find_source_by_id (NULL, tnp_provider->child_watch_id);
         g_source_set_callback(source, (GSourceFunc) g_spawn_close_pid, NULL, NULL);
     }
+    // the session is torn down with the last reference
+    tnp_provider->session = NULL;
+    session_unref();
 
     (*G_OBJECT_CLASS(tnp_provider_parent_class)->finalize)(object);
 }
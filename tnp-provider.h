@@ -37,6 +37,7 @@ typedef struct _TnpProvider      TnpProvider;
 
 GType tnp_provider_get_type (void) G_GNUC_CONST G_GNUC_INTERNAL;
 void tnp_provider_register_type (ThunarxProviderPlugin* plugin) G_GNUC_INTERNAL;
+void tnp_provider_shutdown (void) G_GNUC_INTERNAL;
 
 G_END_DECLS;
 
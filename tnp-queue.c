@@ -0,0 +1,104 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "tnp-queue.h"
+
+typedef struct _TnpQueueNode TnpQueueNode;
+
+struct _TnpQueueNode
+{
+    gpointer      data;
+    TnpQueueNode* next;
+};
+
+struct _TnpQueue
+{
+    // owned by the consumer, always points to an already consumed node
+    TnpQueueNode* head;
+    // keep producer and consumer fields on different cache lines
+    gchar         padding[64 - sizeof(TnpQueueNode*)];
+    // owned by the producer
+    TnpQueueNode* tail;
+};
+
+TnpQueue* tnp_queue_new()
+{
+    TnpQueue* queue = g_slice_new0(TnpQueue);
+    queue->head = queue->tail = g_slice_new0(TnpQueueNode);
+    return queue;
+}
+
+/**
+ * Frees the queue and passes all remaining items to "free_func" (optional).
+ * Neither thread may use the queue any more.
+ */
+void tnp_queue_free(TnpQueue* queue, GDestroyNotify free_func)
+{
+    gpointer data;
+
+    if(queue == NULL)
+    {
+        return;
+    }
+    while((data = tnp_queue_pop(queue)) != NULL)
+    {
+        if(free_func != NULL)
+        {
+            free_func(data);
+        }
+    }
+    g_slice_free(TnpQueueNode, queue->head);
+    g_slice_free(TnpQueue, queue);
+}
+
+/**
+ * Appends "data", which must not be NULL. Producer thread only.
+ */
+void tnp_queue_push(TnpQueue* queue, gpointer data)
+{
+    TnpQueueNode* node = g_slice_new(TnpQueueNode);
+    node->data = data;
+    node->next = NULL;
+    // publishing the node makes its contents visible to the consumer
+    g_atomic_pointer_set(&queue->tail->next, node);
+    queue->tail = node;
+}
+
+/**
+ * Removes the oldest item. Consumer thread only.
+ * @return The item or NULL if the queue is empty
+ */
+gpointer tnp_queue_pop(TnpQueue* queue)
+{
+    TnpQueueNode* head = queue->head;
+    TnpQueueNode* next = g_atomic_pointer_get(&head->next);
+    gpointer data;
+
+    if(next == NULL)
+    {
+        return NULL;
+    }
+    // "next" becomes the new consumed node, so its data can be taken out
+    data = next->data;
+    next->data = NULL;
+    queue->head = next;
+    g_slice_free(TnpQueueNode, head);
+    return data;
+}
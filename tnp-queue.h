@@ -0,0 +1,41 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_QUEUE_H__
+#define __TNP_QUEUE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS;
+
+/**
+ * An unbounded, lock-free single-producer/single-consumer queue. Exactly one
+ * thread may push and exactly one (possibly different) thread may pop.
+ */
+typedef struct _TnpQueue TnpQueue;
+
+TnpQueue* tnp_queue_new (void) G_GNUC_INTERNAL;
+void tnp_queue_free (TnpQueue* queue, GDestroyNotify free_func) G_GNUC_INTERNAL;
+void tnp_queue_push (TnpQueue* queue, gpointer data) G_GNUC_INTERNAL;
+gpointer tnp_queue_pop (TnpQueue* queue) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_QUEUE_H__ */
@@ -0,0 +1,335 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Replays a trace of the client sockets, as recorded with TNP_TRACE=<file>,
+ * through the plugin's parser and caches without Thunar or a Nextcloud
+ * client. The received bytes are framed in the chunks recv() returned them
+ * in, so bursts and split lines behave as they did in the plugin. Sync roots
+ * are taken as sent, they need not exist on the machine replaying the trace.
+ *
+ *   parse    framing and parsing of the received lines
+ *   state    handling of each parsed message by the sync roots and caches
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tnp-framer.h"
+#include "tnp-menu.h"
+#include "tnp-path-arena.h"
+#include "tnp-path-index.h"
+#include "tnp-protocol.h"
+#include "tnp-status.h"
+#include "tnp-trace.h"
+
+// the buffer sizes of the plugin's connections, see tnp-client.c
+#define FRAMER_SIZE PATH_MAX+24
+#define FRAMER_MAX_SIZE 16*FRAMER_SIZE
+
+typedef struct
+{
+    TnpPathIndex*   synced_dirs;
+    TnpPathArena*   arena;
+    TnpStatusCache* status_cache;
+    TnpMenuCache*   menu_cache;
+    // TnpFramer, indexed by connection
+    GPtrArray*      framers;
+    // connection of the message being handled
+    guint           connection;
+    // nanoseconds spent handling each message
+    GArray*         samples;
+    guint64         received;
+    guint64         sent;
+    guint64         lines;
+    guint64         invalid;
+    guint           connects;
+} ReplayState;
+
+// settings, see "options" below
+static gboolean realtime = FALSE;
+static gint repeat = 1;
+
+static GOptionEntry options[] =
+{
+    { "realtime", 't', 0, G_OPTION_ARG_NONE, &realtime, "Keep the timing of the trace instead of replaying as fast as possible", NULL },
+    { "repeat", 'n', 0, G_OPTION_ARG_INT, &repeat, "Number of times to replay the trace", "N" },
+    { NULL }
+};
+
+static gint64 now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static gint compare_samples(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64*)a;
+    gint64 y = *(const gint64*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Send function of the caches: the commands the plugin sent are in the trace.
+ */
+static gboolean replay_send(const gchar* data, gsize length, gpointer user_data)
+{
+    return TRUE;
+}
+
+static gboolean replay_send_to(guint connection, const gchar* data, gsize length, gpointer user_data)
+{
+    return TRUE;
+}
+
+static void replay_register_path(const TnpMessage* message, gpointer user_data)
+{
+    ReplayState* state = user_data;
+
+    tnp_path_index_insert(state->synced_dirs, message->args[0], state->connection);
+}
+
+static void replay_unregister_path(const TnpMessage* message, gpointer user_data)
+{
+    ReplayState* state = user_data;
+
+    tnp_path_index_remove(state->synced_dirs, message->args[0], state->connection);
+}
+
+static void replay_status(const TnpMessage* message, gpointer user_data)
+{
+    ReplayState* state = user_data;
+
+    tnp_status_cache_update(state->status_cache, message->args[0], message->args[1]);
+}
+
+static void replay_update_view(const TnpMessage* message, gpointer user_data)
+{
+    ReplayState* state = user_data;
+
+    tnp_status_cache_invalidate(state->status_cache, message->args[0]);
+    tnp_menu_cache_invalidate(state->menu_cache, message->args[0]);
+}
+
+static void replay_menu_items(const TnpMessage* message, gpointer user_data)
+{
+    ReplayState* state = user_data;
+
+    tnp_menu_cache_handle_message(state->menu_cache, state->connection, message);
+}
+
+// what the client's worker and the provider do with each message
+static const TnpMessageHandler replay_handlers[TNP_MESSAGE_N_TYPES] =
+{
+    [TNP_MESSAGE_REGISTER_PATH]   = replay_register_path,
+    [TNP_MESSAGE_UNREGISTER_PATH] = replay_unregister_path,
+    [TNP_MESSAGE_STATUS]          = replay_status,
+    [TNP_MESSAGE_UPDATE_VIEW]     = replay_update_view,
+    [TNP_MESSAGE_GET_MENU_ITEMS]  = replay_menu_items,
+    [TNP_MESSAGE_MENU_ITEM]       = replay_menu_items,
+};
+
+static TnpFramer* get_framer(ReplayState* state, guint connection)
+{
+    if(connection >= state->framers->len)
+    {
+        g_ptr_array_set_size(state->framers, connection + 1);
+    }
+    if(g_ptr_array_index(state->framers, connection) == NULL)
+    {
+        g_ptr_array_index(state->framers, connection) = tnp_framer_new(FRAMER_SIZE, FRAMER_MAX_SIZE);
+    }
+    return g_ptr_array_index(state->framers, connection);
+}
+
+/**
+ * Frames, parses and handles a chunk of received bytes.
+ */
+static void replay_received(ReplayState* state, const TnpTraceRecord* record)
+{
+    TnpFramer* framer = get_framer(state, record->connection);
+    TnpMessage message;
+    gchar* buffer;
+    gchar* line;
+    gsize available, length, offset;
+    gint64 start, sample;
+
+    state->connection = record->connection;
+    for(offset = 0; offset < record->length; offset += length)
+    {
+        buffer = tnp_framer_reserve(framer, &available);
+        length = MIN(available, record->length - offset);
+        memcpy(buffer, record->data + offset, length);
+        tnp_framer_commit(framer, length);
+        while((line = tnp_framer_next_line(framer, NULL)) != NULL)
+        {
+            state->lines++;
+            if(!tnp_message_parse(line, &message))
+            {
+                state->invalid++;
+                continue;
+            }
+            start = now_ns();
+            tnp_message_dispatch(&message, replay_handlers, state);
+            sample = now_ns() - start;
+            g_array_append_val(state->samples, sample);
+        }
+    }
+}
+
+/**
+ * Replays all records of "reader", waiting for their time if "realtime" is set.
+ * @return The nanoseconds spent handling the records
+ */
+static gint64 replay(ReplayState* state, TnpTraceReader* reader)
+{
+    TnpTraceRecord record;
+    TnpFramer* framer;
+    gint64 start = now_ns();
+    gint64 busy = 0;
+    gint64 begin, delay;
+
+    tnp_trace_reader_rewind(reader);
+    while(tnp_trace_reader_next(reader, &record))
+    {
+        if(realtime)
+        {
+            delay = record.time - (now_ns() - start);
+            if(delay > 0)
+            {
+                g_usleep(delay / 1000);
+            }
+        }
+        begin = now_ns();
+        switch(record.type)
+        {
+            case TNP_TRACE_CONNECTED:
+                state->connects++;
+                tnp_framer_reset(get_framer(state, record.connection));
+                break;
+            case TNP_TRACE_DISCONNECTED:
+                // like tnp_connection_disconnect() and handle_client_events()
+                framer = get_framer(state, record.connection);
+                tnp_framer_reset(framer);
+                tnp_path_index_remove_owner(state->synced_dirs, record.connection);
+                tnp_status_cache_clear(state->status_cache);
+                tnp_menu_cache_disconnect(state->menu_cache, record.connection);
+                break;
+            case TNP_TRACE_RECEIVED:
+                state->received += record.length;
+                replay_received(state, &record);
+                break;
+            case TNP_TRACE_SENT:
+                state->sent += record.length;
+                break;
+            default:
+                break;
+        }
+        // idle callbacks of the caches, like between two reads in the plugin
+        while(g_main_context_iteration(NULL, FALSE))
+        {
+        }
+        busy += now_ns() - begin;
+    }
+    return busy;
+}
+
+int main(int argc, char** argv)
+{
+    GOptionContext* context;
+    GError* error = NULL;
+    ReplayState state = { 0 };
+    TnpTraceReader* reader;
+    gint64 busy = 0;
+    gint64 handling = 0;
+    gdouble p50, p99;
+    guint i;
+    gint n;
+
+    context = g_option_context_new("TRACE - replay a trace of the thunar nextcloud plugin's sockets");
+    g_option_context_add_main_entries(context, options, NULL);
+    if(!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 2;
+    }
+    g_option_context_free(context);
+    if(argc != 2)
+    {
+        g_printerr("Usage: %s [OPTION...] TRACE\n", argv[0]);
+        return 2;
+    }
+    reader = tnp_trace_reader_new(argv[1]);
+    if(reader == NULL)
+    {
+        g_printerr("%s is no trace of this version\n", argv[1]);
+        return 1;
+    }
+
+    state.synced_dirs = tnp_path_index_new();
+    state.arena = tnp_path_arena_new();
+    state.status_cache = tnp_status_cache_new(state.arena, replay_send, NULL, NULL);
+    state.menu_cache = tnp_menu_cache_new(replay_send_to, NULL);
+    state.framers = g_ptr_array_new_with_free_func((GDestroyNotify) tnp_framer_free);
+    state.samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+    for(n = 0; n < MAX(repeat, 1); n++)
+    {
+        busy += replay(&state, reader);
+    }
+    if(tnp_trace_reader_is_truncated(reader))
+    {
+        g_printerr("Warning: %s is truncated\n", argv[1]);
+    }
+
+    for(i = 0; i < state.samples->len; i++)
+    {
+        handling += g_array_index(state.samples, gint64, i);
+    }
+    printf("trace    connects=%u received=%" G_GUINT64_FORMAT "B sent=%" G_GUINT64_FORMAT "B lines=%" G_GUINT64_FORMAT
+           " invalid=%" G_GUINT64_FORMAT " roots=%u\n", state.connects, state.received, state.sent, state.lines,
+           state.invalid, tnp_path_index_size(state.synced_dirs));
+    // everything but the handlers: framing, parsing and the idle callbacks
+    printf("parse    %10.1f MB/s %12.0f lines/s\n",
+           busy - handling > 0 ? state.received * 1e3 / (busy - handling) : 0.0,
+           busy - handling > 0 ? state.lines * 1e9 / (busy - handling) : 0.0);
+    printf("state    n=%-7u", state.samples->len);
+    if(state.samples->len > 0)
+    {
+        g_array_sort(state.samples, compare_samples);
+        p50 = g_array_index(state.samples, gint64, state.samples->len / 2) / 1000.0;
+        p99 = g_array_index(state.samples, gint64, MIN(state.samples->len - 1, state.samples->len * 99 / 100)) / 1000.0;
+        printf(" mean=%9.3fus p50=%9.3fus p99=%9.3fus", handling / 1e3 / state.samples->len, p50, p99);
+    }
+    printf("\n");
+
+    tnp_menu_cache_free(state.menu_cache);
+    tnp_status_cache_free(state.status_cache);
+    tnp_path_arena_free(state.arena);
+    tnp_path_index_free(state.synced_dirs);
+    g_ptr_array_free(state.framers, TRUE);
+    g_array_free(state.samples, TRUE);
+    tnp_trace_reader_free(reader);
+    return 0;
+}
@@ -0,0 +1,143 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "tnp-root-snapshot.h"
+
+#define SNAPSHOT_MAGIC "TNPROOTS"
+// increment whenever the layout changes
+#define SNAPSHOT_VERSION 1
+
+/**
+ * The file starts with this header, followed by "n_roots" absolute paths, each
+ * terminated by a NUL byte. Numbers are in host byte order, the file never
+ * leaves the machine.
+ */
+typedef struct
+{
+    gchar   magic[8];
+    guint32 version;
+    guint32 n_roots;
+} TnpRootSnapshotHeader;
+
+/**
+ * Returns the location of the snapshot in the user's cache directory, which
+ * unlike $XDG_RUNTIME_DIR survives logging out.
+ */
+gchar* tnp_root_snapshot_get_path()
+{
+    return g_build_filename(g_get_user_cache_dir(), "thunar-nextcloud-plugin", "sync-roots", NULL);
+}
+
+/**
+ * Reads the snapshot "filename" into a new index, owning all roots by "owner".
+ * @return The index or NULL if there is no valid snapshot
+ */
+TnpPathIndex* tnp_root_snapshot_load(const gchar* filename, guint owner)
+{
+    GMappedFile* file;
+    TnpRootSnapshotHeader header;
+    TnpPathIndex* index;
+    const gchar* data;
+    const gchar* end;
+    const gchar* root;
+    gsize length;
+    guint i;
+
+    file = g_mapped_file_new(filename, FALSE, NULL);
+    if(file == NULL)
+    {
+        return NULL;
+    }
+    data = g_mapped_file_get_contents(file);
+    length = g_mapped_file_get_length(file);
+    if(length < sizeof(header))
+    {
+        g_mapped_file_unref(file);
+        return NULL;
+    }
+    // the mapping need not be aligned for the header
+    memcpy(&header, data, sizeof(header));
+    if(memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION)
+    {
+        #ifdef G_ENABLE_DEBUG
+        g_message("Ignoring sync root snapshot of another version: %s", filename);
+        #endif
+        g_mapped_file_unref(file);
+        return NULL;
+    }
+    index = tnp_path_index_new();
+    root = data + sizeof(header);
+    for(i = 0; i < header.n_roots; i++)
+    {
+        end = memchr(root, '\0', data + length - root);
+        if(end == NULL || root[0] != '/')
+        {
+            #ifdef G_ENABLE_DEBUG
+            g_message("Ignoring corrupt sync root snapshot: %s", filename);
+            #endif
+            tnp_path_index_free(index);
+            g_mapped_file_unref(file);
+            return NULL;
+        }
+        tnp_path_index_insert(index, root, owner);
+        root = end + 1;
+    }
+    g_mapped_file_unref(file);
+    return index;
+}
+
+/**
+ * Replaces the snapshot "filename" with the roots of "index". The file is
+ * replaced atomically, so concurrent loads see either version.
+ */
+gboolean tnp_root_snapshot_save(const gchar* filename, const TnpPathIndex* index)
+{
+    TnpRootSnapshotHeader header;
+    GPtrArray* roots = tnp_path_index_list(index);
+    GString* contents;
+    gchar* directory;
+    gboolean saved;
+    guint i;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.n_roots = roots->len;
+    contents = g_string_new_len((const gchar*) &header, sizeof(header));
+    for(i = 0; i < roots->len; i++)
+    {
+        // include the terminator
+        g_string_append_len(contents, g_ptr_array_index(roots, i), strlen(g_ptr_array_index(roots, i)) + 1);
+    }
+    directory = g_path_get_dirname(filename);
+    g_mkdir_with_parents(directory, 0700);
+    saved = g_file_set_contents(filename, contents->str, contents->len, NULL);
+    #ifdef G_ENABLE_DEBUG
+    g_message("%s sync root snapshot with %u roots", saved ? "Saved" : "Failed to save", roots->len);
+    #endif
+    g_free(directory);
+    g_string_free(contents, TRUE);
+    g_ptr_array_free(roots, TRUE);
+    return saved;
+}
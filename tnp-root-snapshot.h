@@ -0,0 +1,42 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_ROOT_SNAPSHOT_H__
+#define __TNP_ROOT_SNAPSHOT_H__
+
+#include <glib.h>
+
+#include "tnp-path-index.h"
+
+G_BEGIN_DECLS;
+
+/**
+ * Persists the sync roots between Thunar sessions, so the first menus after a
+ * restart can be answered before the clients have registered their roots
+ * again. The file is a small versioned binary that is memory-mapped when
+ * loaded; files that are invalid or of another version are ignored.
+ */
+gchar* tnp_root_snapshot_get_path (void) G_GNUC_INTERNAL;
+TnpPathIndex* tnp_root_snapshot_load (const gchar* filename, guint owner) G_GNUC_INTERNAL;
+gboolean tnp_root_snapshot_save (const gchar* filename, const TnpPathIndex* index) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_ROOT_SNAPSHOT_H__ */
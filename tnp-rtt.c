@@ -0,0 +1,90 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "tnp-rtt.h"
+
+struct _TnpRtt
+{
+    // smoothed round-trip time and its mean deviation, 0 until the first sample
+    gint64 smoothed;
+    gint64 deviation;
+    gint64 timeout;
+    gint64 min;
+    gint64 max;
+};
+
+/**
+ * Creates an estimate that waits "initial" until the first reply was
+ * measured, and never less than "min" or more than "max".
+ */
+TnpRtt* tnp_rtt_new(gint64 initial, gint64 min, gint64 max)
+{
+    TnpRtt* rtt = g_slice_new0(TnpRtt);
+    rtt->min = min;
+    rtt->max = max;
+    rtt->timeout = CLAMP(initial, min, max);
+    return rtt;
+}
+
+void tnp_rtt_free(TnpRtt* rtt)
+{
+    if(rtt != NULL)
+    {
+        g_slice_free(TnpRtt, rtt);
+    }
+}
+
+/**
+ * Takes the measured round trip of a request into account. Replies that
+ * arrived after their timeout count as well, so the estimate catches up with a
+ * client that became slower.
+ */
+void tnp_rtt_sample(TnpRtt* rtt, gint64 round_trip)
+{
+    round_trip = MAX(round_trip, 0);
+    if(rtt->smoothed == 0)
+    {
+        rtt->smoothed = MAX(round_trip, 1);
+        rtt->deviation = round_trip / 2;
+    }
+    else
+    {
+        rtt->deviation = (3 * rtt->deviation + ABS(rtt->smoothed - round_trip)) / 4;
+        rtt->smoothed = (7 * rtt->smoothed + round_trip) / 8;
+    }
+    rtt->timeout = CLAMP(rtt->smoothed + 4 * rtt->deviation, rtt->min, rtt->max);
+}
+
+/**
+ * Doubles the timeout after a request timed out, so an overloaded client is
+ * given more time until a reply is measured again.
+ */
+void tnp_rtt_backoff(TnpRtt* rtt)
+{
+    rtt->timeout = MIN(rtt->timeout * 2, rtt->max);
+}
+
+/**
+ * Returns how long to wait for a reply.
+ */
+gint64 tnp_rtt_get_timeout(const TnpRtt* rtt)
+{
+    return rtt->timeout;
+}
@@ -0,0 +1,45 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_RTT_H__
+#define __TNP_RTT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS;
+
+/**
+ * Moving estimate of the client's round-trip time, from which the time to
+ * wait for a reply is derived like TCP's retransmission timeout (RFC 6298):
+ * the smoothed round-trip time plus four times its mean deviation, doubled
+ * after every timeout until the next reply is measured. All times are in
+ * microseconds of g_get_monotonic_time().
+ */
+typedef struct _TnpRtt TnpRtt;
+
+TnpRtt* tnp_rtt_new (gint64 initial, gint64 min, gint64 max) G_GNUC_INTERNAL;
+void tnp_rtt_free (TnpRtt* rtt) G_GNUC_INTERNAL;
+void tnp_rtt_sample (TnpRtt* rtt, gint64 round_trip) G_GNUC_INTERNAL;
+void tnp_rtt_backoff (TnpRtt* rtt) G_GNUC_INTERNAL;
+gint64 tnp_rtt_get_timeout (const TnpRtt* rtt) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_RTT_H__ */
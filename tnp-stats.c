@@ -0,0 +1,230 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+
+#include "tnp-stats.h"
+
+// environment variable enabling the statistics
+#define STATS_ENV "TNP_STATS"
+// bucket i counts samples below 2^i nanoseconds, the last one everything else
+#define HISTOGRAM_BUCKETS 40
+
+typedef struct
+{
+    guint64 count;
+    guint64 sum;
+    guint64 max;
+    guint64 buckets[HISTOGRAM_BUCKETS];
+} TnpStatsHistogramData;
+
+static const gchar* counter_names[TNP_STATS_N_COUNTERS] =
+{
+    "reconnects",
+    "bytes_parsed",
+    "messages",
+    "writes",
+    "bytes_sent",
+    "share_timeouts",
+    "menu_timeouts",
+    "status_timeouts",
+    "late_replies",
+};
+
+static const gchar* histogram_names[TNP_STATS_N_HISTOGRAMS] =
+{
+    "startup",
+    "client_start",
+    "menu_build",
+    "realpath",
+    "share_round_trip",
+    "status_round_trip",
+    "menu_round_trip",
+};
+
+gboolean tnp_stats_enabled = FALSE;
+
+static guint64 counters[TNP_STATS_N_COUNTERS];
+static TnpStatsHistogramData histograms[TNP_STATS_N_HISTOGRAMS];
+static gint64 start_time = 0;
+static guint signal_id = 0;
+static gchar* dump_path = NULL;
+
+static gboolean dump_on_signal(gpointer user_data)
+{
+    tnp_stats_dump();
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Enables the statistics if requested through the environment. Must be called
+ * from the main context before any other thread uses the probes.
+ */
+void tnp_stats_init()
+{
+    const gchar* value = g_getenv(STATS_ENV);
+
+    if(tnp_stats_enabled || value == NULL || value[0] == '\0' || strcmp(value, "0") == 0)
+    {
+        return;
+    }
+    tnp_stats_enabled = TRUE;
+    start_time = tnp_stats_now();
+    dump_path = g_strdup_printf("%s/thunar-nextcloud-plugin.%d.stats", g_get_user_runtime_dir(), getpid());
+    signal_id = g_unix_signal_add(SIGUSR1, dump_on_signal, NULL);
+}
+
+/**
+ * Writes a final snapshot and stops collecting.
+ */
+void tnp_stats_shutdown()
+{
+    if(!tnp_stats_enabled)
+    {
+        return;
+    }
+    tnp_stats_dump();
+    g_source_remove(signal_id);
+    signal_id = 0;
+    tnp_stats_enabled = FALSE;
+    g_free(dump_path);
+    dump_path = NULL;
+}
+
+/**
+ * Returns a monotonic timestamp in nanoseconds, never 0.
+ */
+gint64 tnp_stats_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64) ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec + 1;
+}
+
+/**
+ * Returns the current value of "counter", e.g. to measure the difference
+ * caused by a benchmark.
+ */
+guint64 tnp_stats_get(TnpStatsCounter counter)
+{
+    return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+void tnp_stats_add_real(TnpStatsCounter counter, guint64 value)
+{
+    __atomic_fetch_add(&counters[counter], value, __ATOMIC_RELAXED);
+}
+
+void tnp_stats_record_real(TnpStatsHistogram histogram, gint64 start)
+{
+    TnpStatsHistogramData* data = &histograms[histogram];
+    guint64 elapsed = MAX(tnp_stats_now() - start, 0);
+    guint64 max = __atomic_load_n(&data->max, __ATOMIC_RELAXED);
+    guint bucket = MIN(g_bit_storage(elapsed), HISTOGRAM_BUCKETS - 1);
+
+    __atomic_fetch_add(&data->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&data->sum, elapsed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&data->buckets[bucket], 1, __ATOMIC_RELAXED);
+    while(elapsed > max &&
+          !__atomic_compare_exchange_n(&data->max, &max, elapsed, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        // "max" has been reloaded, try again
+    }
+}
+
+/**
+ * Returns the upper bound in microseconds of the bucket containing the
+ * "fraction" quantile of "data", but no more than its maximum.
+ */
+static gdouble histogram_quantile(const TnpStatsHistogramData* data, gdouble fraction)
+{
+    guint64 seen = 0;
+    guint i;
+
+    for(i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+    {
+        seen += data->buckets[i];
+        if(seen > 0 && seen >= data->count * fraction)
+        {
+            break;
+        }
+    }
+    return MIN(G_GUINT64_CONSTANT(1) << i, data->max) / 1000.0;
+}
+
+/**
+ * Writes the current values to $XDG_RUNTIME_DIR/thunar-nextcloud-plugin.<pid>.stats,
+ * with the runtime dir as of tnp_stats_init().
+ * Values are read without stopping other threads, so a snapshot may be off by
+ * the samples recorded while it is taken.
+ * @return FALSE if the statistics are disabled or the file cannot be written
+ */
+gboolean tnp_stats_dump()
+{
+    GString* out;
+    TnpStatsHistogramData data;
+    gboolean ret;
+    guint i, j;
+
+    if(!tnp_stats_enabled)
+    {
+        return FALSE;
+    }
+    out = g_string_new(NULL);
+    g_string_append_printf(out, "# thunar-nextcloud-plugin pid %d, collected for %.3f s\n", getpid(),
+                           (tnp_stats_now() - start_time) / 1e9);
+    for(i = 0; i < TNP_STATS_N_COUNTERS; i++)
+    {
+        g_string_append_printf(out, "%s %" G_GUINT64_FORMAT "\n", counter_names[i],
+                               __atomic_load_n(&counters[i], __ATOMIC_RELAXED));
+    }
+    // percentiles are upper bounds of power-of-two buckets
+    for(i = 0; i < TNP_STATS_N_HISTOGRAMS; i++)
+    {
+        data.count = __atomic_load_n(&histograms[i].count, __ATOMIC_RELAXED);
+        data.sum = __atomic_load_n(&histograms[i].sum, __ATOMIC_RELAXED);
+        data.max = __atomic_load_n(&histograms[i].max, __ATOMIC_RELAXED);
+        for(j = 0; j < HISTOGRAM_BUCKETS; j++)
+        {
+            data.buckets[j] = __atomic_load_n(&histograms[i].buckets[j], __ATOMIC_RELAXED);
+        }
+        g_string_append_printf(out, "%s count=%" G_GUINT64_FORMAT, histogram_names[i], data.count);
+        if(data.count > 0)
+        {
+            g_string_append_printf(out, " mean_us=%.1f p50_us<=%.1f p99_us<=%.1f max_us=%.1f",
+                                   data.sum / 1000.0 / data.count,
+                                   histogram_quantile(&data, 0.5),
+                                   histogram_quantile(&data, 0.99),
+                                   data.max / 1000.0);
+        }
+        g_string_append_c(out, '\n');
+    }
+    ret = g_file_set_contents(dump_path, out->str, out->len, NULL);
+    #ifdef G_ENABLE_DEBUG
+    g_message("Wrote statistics to %s", dump_path);
+    #endif
+    g_string_free(out, TRUE);
+    return ret;
+}
@@ -0,0 +1,107 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_STATS_H__
+#define __TNP_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS;
+
+/**
+ * Counters and latency histograms for the hot paths. They are always compiled
+ * in but only collected if the environment variable TNP_STATS is set; when
+ * disabled, each probe costs a single predictable branch. A snapshot is
+ * written to $XDG_RUNTIME_DIR on SIGUSR1 and at shutdown.
+ *
+ * Thread-safety: probes may be used from any thread.
+ */
+typedef enum
+{
+    // connection attempts after the first one
+    TNP_STATS_RECONNECTS,
+    // bytes received from the client
+    TNP_STATS_BYTES_PARSED,
+    // lines received from the client
+    TNP_STATS_MESSAGES,
+    // sendmsg() calls that wrote data, see tnp-writer.h
+    TNP_STATS_WRITES,
+    // bytes sent to the client
+    TNP_STATS_BYTES_SENT,
+    // share requests given up on because the client did not answer in time
+    TNP_STATS_SHARE_TIMEOUTS,
+    // menu requests given up on, see tnp-menu.h
+    TNP_STATS_MENU_TIMEOUTS,
+    // status requests given up on, see tnp-status.h
+    TNP_STATS_STATUS_TIMEOUTS,
+    // replies that arrived after their request timed out
+    TNP_STATS_LATE_REPLIES,
+    TNP_STATS_N_COUNTERS,
+} TnpStatsCounter;
+
+typedef enum
+{
+    // thunar_extension_initialize(), on the critical path of Thunar's startup
+    TNP_STATS_STARTUP,
+    // the deferred creation of the client and its caches
+    TNP_STATS_CLIENT_START,
+    // tnp_provider_get_file_menu_items()
+    TNP_STATS_MENU_BUILD,
+    // every call of realpath(3)
+    TNP_STATS_REALPATH,
+    // from queueing a command until its reply is handled
+    TNP_STATS_SHARE_ROUND_TRIP,
+    TNP_STATS_STATUS_ROUND_TRIP,
+    TNP_STATS_MENU_ROUND_TRIP,
+    TNP_STATS_N_HISTOGRAMS,
+} TnpStatsHistogram;
+
+// read by the probes below, set once by tnp_stats_init()
+extern gboolean tnp_stats_enabled G_GNUC_INTERNAL;
+
+void tnp_stats_init (void) G_GNUC_INTERNAL;
+void tnp_stats_shutdown (void) G_GNUC_INTERNAL;
+gboolean tnp_stats_dump (void) G_GNUC_INTERNAL;
+gint64 tnp_stats_now (void) G_GNUC_INTERNAL;
+guint64 tnp_stats_get (TnpStatsCounter counter) G_GNUC_INTERNAL;
+void tnp_stats_add_real (TnpStatsCounter counter, guint64 value) G_GNUC_INTERNAL;
+void tnp_stats_record_real (TnpStatsHistogram histogram, gint64 start) G_GNUC_INTERNAL;
+
+/**
+ * Adds "value" to "counter".
+ */
+#define tnp_stats_add(counter, value) \
+    G_STMT_START { if(G_UNLIKELY(tnp_stats_enabled)) tnp_stats_add_real((counter), (value)); } G_STMT_END
+
+/**
+ * Returns the start time for tnp_stats_record(), or 0 if disabled.
+ */
+#define tnp_stats_start() \
+    (G_UNLIKELY(tnp_stats_enabled) ? tnp_stats_now() : 0)
+
+/**
+ * Records the time elapsed since "start" in "histogram".
+ */
+#define tnp_stats_record(histogram, start) \
+    G_STMT_START { if(G_UNLIKELY((start) != 0)) tnp_stats_record_real((histogram), (start)); } G_STMT_END
+
+G_END_DECLS;
+
+#endif /* !__TNP_STATS_H__ */
@@ -0,0 +1,674 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include "tnp-path-arena.h"
+#include "tnp-rtt.h"
+#include "tnp-stats.h"
+#include "tnp-status.h"
+
+// the "shared with me" marker appended to a status, e.g. "OK+SWM"
+#define SHARED_SUFFIX "+SWM"
+// packed into the cache values next to the TnpSyncStatus
+#define SHARED_FLAG 0x100
+// bounds of the time to wait for a status, see tnp-rtt.h
+#define STATUS_TIMEOUT_INITIAL (2 * G_USEC_PER_SEC)
+#define STATUS_TIMEOUT_MIN (G_USEC_PER_SEC / 2)
+#define STATUS_TIMEOUT_MAX (60 * G_USEC_PER_SEC)
+
+typedef struct
+{
+    TnpPathHandle path;
+    gboolean      is_directory;
+} TnpStatusRequest;
+
+/**
+ * A status request waiting for its reply.
+ */
+typedef struct
+{
+    gint64        sent;
+    // the start time for the statistics, 0 if they are disabled
+    gint64        start;
+    // the path may be requested again, but the reply is still expected
+    gboolean      expired;
+} TnpStatusPending;
+
+typedef struct _TnpStatusNode TnpStatusNode;
+
+/**
+ * The status of a path, linked into a tree of directories so that a subtree
+ * can be dropped without looking at unrelated paths. Directories without a
+ * known status are kept as long as they have children. Every node counts the
+ * statuses of its whole subtree, which is kept up to date along the path to
+ * "/" on every change, i.e. in O(depth).
+ */
+struct _TnpStatusNode
+{
+    // holds a reference
+    TnpPathHandle  path;
+    TnpStatusNode* parent;
+    TnpStatusNode* first_child;
+    TnpStatusNode* prev;
+    TnpStatusNode* next;
+    // TnpSyncStatus | SHARED_FLAG, 0 if unknown
+    guint          value;
+    // number of known statuses of the node itself and all nodes below it
+    guint          counts[TNP_SYNC_STATUS_N_STATUSES];
+};
+
+struct _TnpStatusCache
+{
+    // all keys, nodes and queued paths hold a reference to their handle
+    TnpPathArena*        arena;
+    // canonical path handle -> TnpStatusNode
+    GHashTable*          nodes;
+    // paths whose status has been requested but not received yet ->
+    // TnpStatusPending
+    GHashTable*          in_flight;
+    // requests in "in_flight" that did not time out yet
+    guint                waiting;
+    guint                timeout_id;
+    TnpRtt*              rtt;
+    // TnpStatusRequest collected during the current main loop iteration
+    GArray*              queue;
+    guint                flush_id;
+    TnpStatusSendFunc    send_func;
+    TnpStatusChangedFunc changed_func;
+    gpointer             user_data;
+};
+
+static void tnp_status_node_free(gpointer data)
+{
+    g_slice_free(TnpStatusNode, data);
+}
+
+static TnpStatusNode* tnp_status_cache_lookup_node(TnpStatusCache* cache, const gchar* path)
+{
+    TnpPathHandle handle = tnp_path_arena_lookup(cache->arena, path);
+
+    if(handle == TNP_PATH_HANDLE_NONE)
+    {
+        return NULL;
+    }
+    return g_hash_table_lookup(cache->nodes, TNP_PATH_HANDLE_TO_POINTER(handle));
+}
+
+/**
+ * Returns the node of "path", creating it and any missing parent directories.
+ */
+static TnpStatusNode* tnp_status_cache_ensure_node(TnpStatusCache* cache, const gchar* path)
+{
+    gchar buffer[PATH_MAX];
+    TnpStatusNode* node;
+    TnpStatusNode* child = NULL;
+    TnpStatusNode* result = NULL;
+    gchar* slash;
+    gboolean created;
+
+    g_strlcpy(buffer, path, sizeof(buffer));
+    do
+    {
+        node = tnp_status_cache_lookup_node(cache, buffer);
+        created = node == NULL;
+        if(created)
+        {
+            node = g_slice_new0(TnpStatusNode);
+            node->path = tnp_path_arena_intern(cache->arena, buffer);
+            g_hash_table_insert(cache->nodes, TNP_PATH_HANDLE_TO_POINTER(node->path), node);
+        }
+        if(child != NULL)
+        {
+            child->parent = node;
+            child->next = node->first_child;
+            if(child->next != NULL)
+            {
+                child->next->prev = child;
+            }
+            node->first_child = child;
+        }
+        if(result == NULL)
+        {
+            result = node;
+        }
+        // continue with the parent directory up to "/"
+        child = node;
+        slash = strrchr(buffer, '/');
+        if(slash == NULL || buffer[1] == '\0')
+        {
+            break;
+        }
+        slash[slash == buffer ? 1 : 0] = '\0';
+    }
+    while(created);
+    return result;
+}
+
+/**
+ * Adds "delta" to the count of "status" of "node" and all its parents.
+ */
+static void tnp_status_node_count(TnpStatusNode* node, TnpSyncStatus status, gint delta)
+{
+    if(status == TNP_SYNC_STATUS_UNKNOWN)
+    {
+        return;
+    }
+    for(; node != NULL; node = node->parent)
+    {
+        node->counts[status] += delta;
+    }
+}
+
+static void tnp_status_cache_remove_node(TnpStatusCache* cache, TnpStatusNode* node)
+{
+    TnpPathHandle handle = node->path;
+
+    g_hash_table_remove(cache->nodes, TNP_PATH_HANDLE_TO_POINTER(handle));
+    tnp_path_arena_unref(cache->arena, handle);
+}
+
+/**
+ * Frees "node" and its parents as long as they have neither a status nor
+ * children.
+ */
+static void tnp_status_cache_prune(TnpStatusCache* cache, TnpStatusNode* node)
+{
+    TnpStatusNode* parent;
+
+    while(node != NULL && node->value == 0 && node->first_child == NULL)
+    {
+        parent = node->parent;
+        if(node->prev != NULL)
+        {
+            node->prev->next = node->next;
+        }
+        else if(parent != NULL)
+        {
+            parent->first_child = node->next;
+        }
+        if(node->next != NULL)
+        {
+            node->next->prev = node->prev;
+        }
+        tnp_status_cache_remove_node(cache, node);
+        node = parent;
+    }
+}
+
+/**
+ * Frees everything below "node", adding a reference to each path with a known
+ * status to "dropped".
+ */
+static void tnp_status_cache_drop_children(TnpStatusCache* cache, TnpStatusNode* node, GArray* dropped)
+{
+    TnpStatusNode* child;
+    TnpPathHandle handle;
+
+    while((child = node->first_child) != NULL)
+    {
+        node->first_child = child->next;
+        tnp_status_cache_drop_children(cache, child, dropped);
+        if(child->value != 0)
+        {
+            handle = tnp_path_arena_ref(cache->arena, child->path);
+            g_array_append_val(dropped, handle);
+        }
+        tnp_status_cache_remove_node(cache, child);
+    }
+}
+
+/**
+ * Removes "handle" from "table" and drops the reference held by its key.
+ */
+static void tnp_status_cache_remove(TnpStatusCache* cache, GHashTable* table, TnpPathHandle handle)
+{
+    if(g_hash_table_remove(table, TNP_PATH_HANDLE_TO_POINTER(handle)))
+    {
+        tnp_path_arena_unref(cache->arena, handle);
+    }
+}
+
+static void tnp_status_cache_remove_all(TnpStatusCache* cache, GHashTable* table)
+{
+    GHashTableIter iter;
+    gpointer key;
+
+    g_hash_table_iter_init(&iter, table);
+    while(g_hash_table_iter_next(&iter, &key, NULL))
+    {
+        tnp_path_arena_unref(cache->arena, TNP_POINTER_TO_PATH_HANDLE(key));
+    }
+    g_hash_table_remove_all(table);
+}
+
+static gboolean tnp_status_cache_timeout(gpointer user_data);
+
+/**
+ * (Re)starts the timeout while requests are waiting for their replies. It is
+ * restarted whenever a reply arrives, so it only fires if the client made no
+ * progress for that long.
+ */
+static void tnp_status_cache_update_timeout(TnpStatusCache* cache, gboolean progress)
+{
+    if(cache->timeout_id != 0 && (progress || cache->waiting == 0))
+    {
+        g_source_remove(cache->timeout_id);
+        cache->timeout_id = 0;
+    }
+    if(cache->timeout_id == 0 && cache->waiting > 0)
+    {
+        cache->timeout_id = g_timeout_add(MAX(tnp_rtt_get_timeout(cache->rtt) / 1000, 1),
+                                          tnp_status_cache_timeout, cache);
+    }
+}
+
+/**
+ * Gives up on the requests that got no reply within the timeout, so their
+ * paths are requested again by the next tnp_status_cache_request(). They stay
+ * in flight, so their late replies are still recognized as such.
+ */
+static gboolean tnp_status_cache_timeout(gpointer user_data)
+{
+    TnpStatusCache* cache = user_data;
+    TnpStatusPending* pending;
+    GHashTableIter iter;
+    gpointer value;
+    gint64 now = g_get_monotonic_time();
+    gint64 timeout = tnp_rtt_get_timeout(cache->rtt);
+    gboolean expired = FALSE;
+
+    cache->timeout_id = 0;
+    g_hash_table_iter_init(&iter, cache->in_flight);
+    while(g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        pending = value;
+        if(pending->expired || now - pending->sent < timeout)
+        {
+            continue;
+        }
+        pending->expired = TRUE;
+        cache->waiting--;
+        tnp_stats_add(TNP_STATS_STATUS_TIMEOUTS, 1);
+        expired = TRUE;
+    }
+    if(expired)
+    {
+        tnp_rtt_backoff(cache->rtt);
+    }
+    tnp_status_cache_update_timeout(cache, FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Forgets the request for "handle", if any.
+ */
+static void tnp_status_cache_settle(TnpStatusCache* cache, TnpPathHandle handle)
+{
+    TnpStatusPending* pending = g_hash_table_lookup(cache->in_flight, TNP_PATH_HANDLE_TO_POINTER(handle));
+
+    if(pending != NULL && !pending->expired)
+    {
+        cache->waiting--;
+    }
+    tnp_status_cache_remove(cache, cache->in_flight, handle);
+}
+
+/**
+ * Empties the request queue and drops its references.
+ */
+static void tnp_status_cache_clear_queue(TnpStatusCache* cache)
+{
+    guint i;
+
+    for(i = 0; i < cache->queue->len; i++)
+    {
+        tnp_path_arena_unref(cache->arena, g_array_index(cache->queue, TnpStatusRequest, i).path);
+    }
+    g_array_set_size(cache->queue, 0);
+}
+
+/**
+ * Sends all queued requests to the client in one write. Runs once per main
+ * loop iteration, so a folder full of files costs a single burst instead of
+ * one round-trip per file.
+ */
+static gboolean tnp_status_cache_flush(gpointer user_data)
+{
+    TnpStatusCache* cache = user_data;
+    TnpStatusRequest* request;
+    GString* burst;
+    guint i;
+
+    cache->flush_id = 0;
+    burst = g_string_sized_new(cache->queue->len * 64);
+    for(i = 0; i < cache->queue->len; i++)
+    {
+        request = &g_array_index(cache->queue, TnpStatusRequest, i);
+        g_string_append(burst, request->is_directory ? "RETRIEVE_FOLDER_STATUS:" : "RETRIEVE_FILE_STATUS:");
+        g_string_append(burst, tnp_path_arena_get(cache->arena, request->path));
+        g_string_append_c(burst, '\n');
+    }
+    if(burst->len > 0 && !cache->send_func(burst->str, burst->len, cache->user_data))
+    {
+        // allow the paths to be requested again later
+        for(i = 0; i < cache->queue->len; i++)
+        {
+            request = &g_array_index(cache->queue, TnpStatusRequest, i);
+            tnp_status_cache_settle(cache, request->path);
+        }
+        tnp_status_cache_update_timeout(cache, FALSE);
+    }
+    tnp_status_cache_clear_queue(cache);
+    g_string_free(burst, TRUE);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Creates an empty status cache keeping its paths in "arena". Requests are
+ * written through "send_func"; "changed_func" is called whenever the known
+ * status of a path changes.
+ */
+TnpStatusCache* tnp_status_cache_new(TnpPathArena* arena,
+                                     TnpStatusSendFunc send_func,
+                                     TnpStatusChangedFunc changed_func,
+                                     gpointer user_data)
+{
+    TnpStatusCache* cache = g_slice_new0(TnpStatusCache);
+    cache->arena = arena;
+    cache->nodes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, tnp_status_node_free);
+    cache->in_flight = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    cache->rtt = tnp_rtt_new(STATUS_TIMEOUT_INITIAL, STATUS_TIMEOUT_MIN, STATUS_TIMEOUT_MAX);
+    cache->queue = g_array_new(FALSE, FALSE, sizeof(TnpStatusRequest));
+    cache->send_func = send_func;
+    cache->changed_func = changed_func;
+    cache->user_data = user_data;
+    return cache;
+}
+
+void tnp_status_cache_free(TnpStatusCache* cache)
+{
+    if(cache == NULL)
+    {
+        return;
+    }
+    // also cancels the pending flush and the timeout
+    tnp_status_cache_clear(cache);
+    tnp_rtt_free(cache->rtt);
+    g_hash_table_destroy(cache->nodes);
+    g_hash_table_destroy(cache->in_flight);
+    g_array_free(cache->queue, TRUE);
+    g_slice_free(TnpStatusCache, cache);
+}
+
+/**
+ * Forgets all statuses and outstanding requests, e.g. after the connection to
+ * the client was lost.
+ */
+void tnp_status_cache_clear(TnpStatusCache* cache)
+{
+    if(cache->flush_id != 0)
+    {
+        g_source_remove(cache->flush_id);
+        cache->flush_id = 0;
+    }
+    tnp_status_cache_remove_all(cache, cache->nodes);
+    tnp_status_cache_remove_all(cache, cache->in_flight);
+    tnp_status_cache_clear_queue(cache);
+    cache->waiting = 0;
+    tnp_status_cache_update_timeout(cache, FALSE);
+}
+
+/**
+ * Returns the cached status of "path" without talking to the client.
+ * @param shared Set to TRUE if the file was shared with the user (optional)
+ */
+TnpSyncStatus tnp_status_cache_get(TnpStatusCache* cache, const gchar* path, gboolean* shared)
+{
+    TnpStatusNode* node = tnp_status_cache_lookup_node(cache, path);
+    guint value = node != NULL ? node->value : 0;
+
+    if(shared != NULL)
+    {
+        *shared = (value & SHARED_FLAG) != 0;
+    }
+    return value & ~SHARED_FLAG;
+}
+
+/**
+ * Summarizes the known statuses of "path" and everything below it in O(1),
+ * without asking the client: ERROR if any of them failed, otherwise SYNC if
+ * any is being synced, then NEW, OK, IGNORE and NOP.
+ * @return The summary or TNP_SYNC_STATUS_UNKNOWN if no status is known
+ */
+TnpSyncStatus tnp_status_cache_get_recursive(TnpStatusCache* cache, const gchar* path)
+{
+    static const TnpSyncStatus precedence[] =
+    {
+        TNP_SYNC_STATUS_ERROR,
+        TNP_SYNC_STATUS_SYNC,
+        TNP_SYNC_STATUS_NEW,
+        TNP_SYNC_STATUS_OK,
+        TNP_SYNC_STATUS_IGNORE,
+        TNP_SYNC_STATUS_NOP,
+    };
+    TnpStatusNode* node = tnp_status_cache_lookup_node(cache, path);
+    guint i;
+
+    for(i = 0; node != NULL && i < G_N_ELEMENTS(precedence); i++)
+    {
+        if(node->counts[precedence[i]] > 0)
+        {
+            return precedence[i];
+        }
+    }
+    return TNP_SYNC_STATUS_UNKNOWN;
+}
+
+/**
+ * Returns how many of the known statuses of "path" and everything below it
+ * are "status", in O(1).
+ */
+guint tnp_status_cache_count(TnpStatusCache* cache, const gchar* path, TnpSyncStatus status)
+{
+    TnpStatusNode* node = tnp_status_cache_lookup_node(cache, path);
+
+    if(node == NULL || status == TNP_SYNC_STATUS_UNKNOWN || status >= TNP_SYNC_STATUS_N_STATUSES)
+    {
+        return 0;
+    }
+    return node->counts[status];
+}
+
+/**
+ * Queues a status request for "path" unless its status is already known or
+ * requested and not timed out yet. Queued requests are sent together from an
+ * idle callback.
+ */
+void tnp_status_cache_request(TnpStatusCache* cache, const gchar* path, gboolean is_directory)
+{
+    TnpStatusRequest request;
+    TnpPathHandle handle = tnp_path_arena_lookup(cache->arena, path);
+    TnpStatusNode* node;
+    TnpStatusPending* pending = NULL;
+
+    if(handle != TNP_PATH_HANDLE_NONE)
+    {
+        node = g_hash_table_lookup(cache->nodes, TNP_PATH_HANDLE_TO_POINTER(handle));
+        pending = g_hash_table_lookup(cache->in_flight, TNP_PATH_HANDLE_TO_POINTER(handle));
+        if((node != NULL && node->value != 0) || (pending != NULL && !pending->expired))
+        {
+            return;
+        }
+    }
+    if(pending == NULL)
+    {
+        pending = g_new(TnpStatusPending, 1);
+        handle = tnp_path_arena_intern(cache->arena, path);
+        g_hash_table_insert(cache->in_flight, TNP_PATH_HANDLE_TO_POINTER(handle), pending);
+    }
+    // a late reply to the expired request answers this one as well
+    pending->sent = g_get_monotonic_time();
+    pending->start = tnp_stats_start();
+    pending->expired = FALSE;
+    cache->waiting++;
+    request.path = tnp_path_arena_ref(cache->arena, handle);
+    request.is_directory = is_directory;
+    g_array_append_val(cache->queue, request);
+    if(cache->flush_id == 0)
+    {
+        cache->flush_id = g_idle_add(tnp_status_cache_flush, cache);
+    }
+    tnp_status_cache_update_timeout(cache, FALSE);
+}
+
+/**
+ * Records the status of "path", as received in a "STATUS:" reply or push
+ * message, and reports it if it changed.
+ */
+void tnp_status_cache_update(TnpStatusCache* cache, const gchar* status, const gchar* path)
+{
+    gboolean shared;
+    guint value;
+    TnpStatusPending* pending;
+    TnpStatusNode* node;
+
+    value = tnp_sync_status_parse(status, &shared);
+    if(shared)
+    {
+        value |= SHARED_FLAG;
+    }
+    node = tnp_status_cache_ensure_node(cache, path);
+    // push messages are no replies
+    pending = g_hash_table_lookup(cache->in_flight, TNP_PATH_HANDLE_TO_POINTER(node->path));
+    if(pending != NULL)
+    {
+        tnp_stats_record(TNP_STATS_STATUS_ROUND_TRIP, pending->start);
+        // late replies are measured too, so the timeout adapts to a slower client
+        tnp_rtt_sample(cache->rtt, g_get_monotonic_time() - pending->sent);
+        if(pending->expired)
+        {
+            tnp_stats_add(TNP_STATS_LATE_REPLIES, 1);
+        }
+        tnp_status_cache_settle(cache, node->path);
+        tnp_status_cache_update_timeout(cache, TRUE);
+    }
+    if(node->value == value)
+    {
+        // drop the node again if it was only created for an unknown status
+        tnp_status_cache_prune(cache, node);
+        return;
+    }
+    tnp_status_node_count(node, node->value & ~SHARED_FLAG, -1);
+    tnp_status_node_count(node, value & ~SHARED_FLAG, 1);
+    node->value = value;
+    tnp_status_cache_prune(cache, node);
+    if(cache->changed_func != NULL)
+    {
+        cache->changed_func(path, value & ~SHARED_FLAG, shared, cache->user_data);
+    }
+}
+
+/**
+ * Forgets the statuses of "path" and everything below it, e.g. because the
+ * client asked to refresh the view of a directory. Only the subtree is
+ * visited. Each forgotten status is reported as TNP_SYNC_STATUS_UNKNOWN.
+ */
+void tnp_status_cache_invalidate(TnpStatusCache* cache, const gchar* path)
+{
+    TnpStatusNode* node = tnp_status_cache_lookup_node(cache, path);
+    TnpStatusNode* parent;
+    TnpPathHandle handle;
+    GArray* dropped;
+    guint i;
+
+    if(node == NULL)
+    {
+        return;
+    }
+    // the parents lose all statuses of the subtree
+    for(i = 0; i < TNP_SYNC_STATUS_N_STATUSES; i++)
+    {
+        for(parent = node->parent; parent != NULL; parent = parent->parent)
+        {
+            parent->counts[i] -= node->counts[i];
+        }
+    }
+    memset(node->counts, 0, sizeof(node->counts));
+    dropped = g_array_new(FALSE, FALSE, sizeof(TnpPathHandle));
+    tnp_status_cache_drop_children(cache, node, dropped);
+    if(node->value != 0)
+    {
+        node->value = 0;
+        handle = tnp_path_arena_ref(cache->arena, node->path);
+        g_array_append_val(dropped, handle);
+    }
+    tnp_status_cache_prune(cache, node);
+    // report once the tree is consistent again
+    for(i = 0; i < dropped->len; i++)
+    {
+        handle = g_array_index(dropped, TnpPathHandle, i);
+        if(cache->changed_func != NULL)
+        {
+            cache->changed_func(tnp_path_arena_get(cache->arena, handle), TNP_SYNC_STATUS_UNKNOWN, FALSE,
+                                cache->user_data);
+        }
+        tnp_path_arena_unref(cache->arena, handle);
+    }
+    g_array_free(dropped, TRUE);
+}
+
+/**
+ * Parses the status field of a "STATUS:" message, e.g. "SYNC" or "OK+SWM".
+ * @param shared Set to TRUE if the "shared with me" marker is present
+ */
+TnpSyncStatus tnp_sync_status_parse(const gchar* status, gboolean* shared)
+{
+    static const struct
+    {
+        const gchar*  name;
+        TnpSyncStatus status;
+    } names[] =
+    {
+        { "OK",     TNP_SYNC_STATUS_OK },
+        { "SYNC",   TNP_SYNC_STATUS_SYNC },
+        { "NEW",    TNP_SYNC_STATUS_NEW },
+        { "IGNORE", TNP_SYNC_STATUS_IGNORE },
+        { "ERROR",  TNP_SYNC_STATUS_ERROR },
+        { "NOP",    TNP_SYNC_STATUS_NOP },
+    };
+    gsize length = strlen(status);
+    guint i;
+
+    *shared = g_str_has_suffix(status, SHARED_SUFFIX);
+    if(*shared)
+    {
+        length -= strlen(SHARED_SUFFIX);
+    }
+    for(i = 0; i < G_N_ELEMENTS(names); i++)
+    {
+        if(strlen(names[i].name) == length && strncmp(names[i].name, status, length) == 0)
+        {
+            return names[i].status;
+        }
+    }
+    return TNP_SYNC_STATUS_UNKNOWN;
+}
@@ -0,0 +1,71 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_STATUS_H__
+#define __TNP_STATUS_H__
+
+#include <glib.h>
+
+#include "tnp-path-arena.h"
+
+G_BEGIN_DECLS;
+
+/**
+ * Sync state of a file as reported by the Nextcloud client in
+ * "STATUS:<status>:<path>" messages.
+ */
+typedef enum
+{
+    TNP_SYNC_STATUS_UNKNOWN = 0,
+    TNP_SYNC_STATUS_OK,
+    TNP_SYNC_STATUS_SYNC,
+    TNP_SYNC_STATUS_NEW,
+    TNP_SYNC_STATUS_IGNORE,
+    TNP_SYNC_STATUS_ERROR,
+    TNP_SYNC_STATUS_NOP,
+    TNP_SYNC_STATUS_N_STATUSES,
+} TnpSyncStatus;
+
+typedef struct _TnpStatusCache TnpStatusCache;
+
+/**
+ * Writes "length" bytes of commands to the client.
+ * @return FALSE if the commands could not be sent
+ */
+typedef gboolean (*TnpStatusSendFunc) (const gchar* data, gsize length, gpointer user_data);
+typedef void (*TnpStatusChangedFunc) (const gchar* path, TnpSyncStatus status, gboolean shared, gpointer user_data);
+
+TnpStatusCache* tnp_status_cache_new (TnpPathArena* arena,
+                                      TnpStatusSendFunc send_func,
+                                      TnpStatusChangedFunc changed_func,
+                                      gpointer user_data) G_GNUC_INTERNAL;
+void tnp_status_cache_free (TnpStatusCache* cache) G_GNUC_INTERNAL;
+void tnp_status_cache_clear (TnpStatusCache* cache) G_GNUC_INTERNAL;
+TnpSyncStatus tnp_status_cache_get (TnpStatusCache* cache, const gchar* path, gboolean* shared) G_GNUC_INTERNAL;
+TnpSyncStatus tnp_status_cache_get_recursive (TnpStatusCache* cache, const gchar* path) G_GNUC_INTERNAL;
+guint tnp_status_cache_count (TnpStatusCache* cache, const gchar* path, TnpSyncStatus status) G_GNUC_INTERNAL;
+void tnp_status_cache_request (TnpStatusCache* cache, const gchar* path, gboolean is_directory) G_GNUC_INTERNAL;
+void tnp_status_cache_update (TnpStatusCache* cache, const gchar* status, const gchar* path) G_GNUC_INTERNAL;
+void tnp_status_cache_invalidate (TnpStatusCache* cache, const gchar* path) G_GNUC_INTERNAL;
+TnpSyncStatus tnp_sync_status_parse (const gchar* status, gboolean* shared) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_STATUS_H__ */
@@ -0,0 +1,713 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Unit tests of the core library, run headless without a Nextcloud client:
+ *
+ *   ./tnp-test            run all tests
+ *   ./tnp-test -p /framer run the tests below a path, see --help
+ */
+
+#include <string.h>
+
+#include "tnp-core.h"
+
+/**
+ * Runs the main loop until nothing is left to do, e.g. the idle callbacks of
+ * the caches and the arena.
+ */
+static void run_idle()
+{
+    while(g_main_context_iteration(NULL, FALSE));
+}
+
+/**
+ * Feeds "length" bytes of "data" to "framer" in chunks of at most "chunk"
+ * bytes, like a socket returns them, and collects the complete lines.
+ */
+static void feed(TnpFramer* framer, const gchar* data, gsize length, gsize chunk, GPtrArray* lines)
+{
+    gsize offset, size, available;
+    gchar* buffer;
+    gchar* line;
+
+    for(offset = 0; offset < length; offset += size)
+    {
+        buffer = tnp_framer_reserve(framer, &available);
+        size = MIN(available, MIN(length - offset, chunk));
+        memcpy(buffer, data + offset, size);
+        tnp_framer_commit(framer, size);
+        // lines are only valid until the next reserve
+        while((line = tnp_framer_next_line(framer, NULL)) != NULL)
+        {
+            g_ptr_array_add(lines, g_strdup(line));
+        }
+    }
+}
+
+static void test_framer_partial_lines()
+{
+    TnpFramer* framer = tnp_framer_new(64, 1024);
+    GPtrArray* lines = g_ptr_array_new_with_free_func(g_free);
+
+    feed(framer, "STATUS:OK:/a\nSTA", 16, 4096, lines);
+    g_assert_cmpuint(lines->len, ==, 1);
+    g_assert_cmpstr(g_ptr_array_index(lines, 0), ==, "STATUS:OK:/a");
+    // the rest of the line arrives later, terminated by "\r\n"
+    feed(framer, "TUS:SYNC:/b\r\n\n", 14, 1, lines);
+    g_assert_cmpuint(lines->len, ==, 3);
+    g_assert_cmpstr(g_ptr_array_index(lines, 1), ==, "STATUS:SYNC:/b");
+    g_assert_cmpstr(g_ptr_array_index(lines, 2), ==, "");
+    g_assert_cmpuint(tnp_framer_dropped_lines(framer), ==, 0);
+
+    // nothing buffered survives a reset
+    feed(framer, "STATUS:OK:/c", 12, 4096, lines);
+    tnp_framer_reset(framer);
+    feed(framer, "STATUS:OK:/d\n", 13, 4096, lines);
+    g_assert_cmpuint(lines->len, ==, 4);
+    g_assert_cmpstr(g_ptr_array_index(lines, 3), ==, "STATUS:OK:/d");
+
+    g_ptr_array_free(lines, TRUE);
+    tnp_framer_free(framer);
+}
+
+static void test_framer_oversize()
+{
+    TnpFramer* framer = tnp_framer_new(64, 128);
+    GPtrArray* lines = g_ptr_array_new_with_free_func(g_free);
+    GString* stream = g_string_new("STATUS:OK:/before\n");
+
+    // a line that never fits is dropped up to its newline, in any chunk size
+    g_string_append(stream, "STATUS:OK:/");
+    g_string_append_printf(stream, "%0500d", 0);
+    g_string_append(stream, "\nSTATUS:OK:/after\n");
+    feed(framer, stream->str, stream->len, 7, lines);
+    g_assert_cmpuint(lines->len, ==, 2);
+    g_assert_cmpstr(g_ptr_array_index(lines, 0), ==, "STATUS:OK:/before");
+    g_assert_cmpstr(g_ptr_array_index(lines, 1), ==, "STATUS:OK:/after");
+    g_assert_cmpuint(tnp_framer_dropped_lines(framer), ==, 1);
+
+    g_string_free(stream, TRUE);
+    g_ptr_array_free(lines, TRUE);
+    tnp_framer_free(framer);
+}
+
+static void test_framer_growth()
+{
+    TnpFramer* framer = tnp_framer_new(64, 1024);
+    GPtrArray* lines = g_ptr_array_new_with_free_func(g_free);
+    GString* stream = g_string_new(NULL);
+    gchar* path = g_strnfill(1000, 'x');
+    gsize available;
+
+    // the buffer grows up to its maximum for a long line
+    g_string_append_printf(stream, "UPDATE_VIEW:%s\n", path);
+    g_assert_cmpuint(stream->len, <=, 1024);
+    feed(framer, stream->str, stream->len, 100, lines);
+    g_assert_cmpuint(lines->len, ==, 1);
+    g_assert_cmpstr(g_ptr_array_index(lines, 0), ==, g_strchomp(stream->str));
+    g_assert_cmpuint(tnp_framer_dropped_lines(framer), ==, 0);
+    // but not beyond
+    tnp_framer_reserve(framer, &available);
+    g_assert_cmpuint(available, <=, 1024);
+
+    g_free(path);
+    g_string_free(stream, TRUE);
+    g_ptr_array_free(lines, TRUE);
+    tnp_framer_free(framer);
+}
+
+/**
+ * Streams millions of STATUS lines through the framer in chunks of random
+ * size, like a client reporting a large sync, and checks that every line
+ * arrives once and intact. Lines of varying length, some terminated by
+ * "\r\n", make the chunks end anywhere in a line.
+ */
+static void test_framer_flood()
+{
+    // distinct lines, repeated to build the flood
+    const guint n_distinct = 10007;
+    const guint n_lines = 2000000;
+    TnpFramer* framer = tnp_framer_new(4096, 65536);
+    GString* block = g_string_new(NULL);
+    GArray* starts = g_array_new(FALSE, FALSE, sizeof(gsize));
+    gchar* padding = g_strnfill(512, 'p');
+    gsize offset, size, available, length, expected_length;
+    guint64 total, position = 0;
+    guint received = 0;
+    const gchar* expected;
+    gchar* buffer;
+    gchar* line;
+    guint i;
+
+    for(i = 0; i < n_distinct; i++)
+    {
+        g_array_append_val(starts, block->len);
+        g_string_append_printf(block, "STATUS:%s:/home/u/Nextcloud/dir-%u/%.*sfile-%u%s",
+                               i % 3 == 0 ? "SYNC" : "OK", i % 97, (gint) (i * 7919 % 513), padding, i,
+                               i % 5 == 0 ? "\r\n" : "\n");
+    }
+    g_array_append_val(starts, block->len);
+    total = (guint64) n_lines / n_distinct * block->len;
+    if(n_lines % n_distinct != 0)
+    {
+        total += g_array_index(starts, gsize, n_lines % n_distinct);
+    }
+
+    while(position < total)
+    {
+        buffer = tnp_framer_reserve(framer, &available);
+        // mostly small reads, sometimes a full buffer
+        size = g_test_rand_bit() ? g_test_rand_int_range(1, 64) : g_test_rand_int_range(1, 16384);
+        size = MIN(MIN(size, available), total - position);
+        for(length = 0; length < size; length += offset)
+        {
+            // copy across the end of the block
+            offset = MIN(size - length, block->len - (position + length) % block->len);
+            memcpy(buffer + length, block->str + (position + length) % block->len, offset);
+        }
+        tnp_framer_commit(framer, size);
+        position += size;
+        while((line = tnp_framer_next_line(framer, &length)) != NULL)
+        {
+            i = received % n_distinct;
+            expected = block->str + g_array_index(starts, gsize, i);
+            expected_length = g_array_index(starts, gsize, i + 1) - g_array_index(starts, gsize, i);
+            expected_length -= i % 5 == 0 ? 2 : 1;
+            if(length != expected_length || memcmp(line, expected, length) != 0)
+            {
+                g_error("Line %u is \"%.40s...\" (%" G_GSIZE_FORMAT " bytes), expected \"%.40s...\"",
+                        received, line, length, expected);
+            }
+            received++;
+        }
+    }
+    g_assert_cmpuint(received, ==, n_lines);
+    g_assert_cmpuint(tnp_framer_dropped_lines(framer), ==, 0);
+    g_assert_null(tnp_framer_next_line(framer, NULL));
+
+    g_free(padding);
+    g_array_free(starts, TRUE);
+    g_string_free(block, TRUE);
+    tnp_framer_free(framer);
+}
+
+static void test_protocol_parse()
+{
+    TnpMessage message;
+    gchar line[64];
+
+    // the last argument extends to the end of the line
+    strcpy(line, "STATUS:OK+SWM:/a:b");
+    g_assert_true(tnp_message_parse(line, &message));
+    g_assert_cmpint(message.type, ==, TNP_MESSAGE_STATUS);
+    g_assert_cmpuint(message.n_args, ==, 2);
+    g_assert_cmpstr(message.args[0], ==, "OK+SWM");
+    g_assert_cmpstr(message.args[1], ==, "/a:b");
+
+    // optional arguments
+    strcpy(line, "VERSION:3.1");
+    g_assert_true(tnp_message_parse(line, &message));
+    g_assert_cmpuint(message.n_args, ==, 1);
+    strcpy(line, "VERSION:3.1:1.1");
+    g_assert_true(tnp_message_parse(line, &message));
+    g_assert_cmpuint(message.n_args, ==, 2);
+    g_assert_cmpstr(message.args[1], ==, "1.1");
+
+    // empty arguments count
+    strcpy(line, "MENU_ITEM:SHARE::Share");
+    g_assert_true(tnp_message_parse(line, &message));
+    g_assert_cmpstr(message.args[1], ==, "");
+    g_assert_cmpstr(message.args[2], ==, "Share");
+
+    // too few arguments or none at all
+    strcpy(line, "MENU_ITEM:SHARE:d");
+    g_assert_false(tnp_message_parse(line, &message));
+    g_assert_cmpint(message.type, ==, TNP_MESSAGE_UNKNOWN);
+    g_assert_cmpuint(message.n_args, ==, 0);
+    strcpy(line, "STATUS");
+    g_assert_false(tnp_message_parse(line, &message));
+    strcpy(line, "");
+    g_assert_false(tnp_message_parse(line, &message));
+}
+
+static void test_protocol_lookup_command()
+{
+    static const gchar* unknown[] =
+    {
+        // as long as known commands, differing where lookup_command() looks
+        // or only elsewhere
+        "STATES", "STRONG", "SHARED", "SHARX", "UPDATE_VIEX", "GET_STRINGZ",
+        "XPDATE_VIEW", "status", "REGISTER_PATX", "GET_MENU_ITEMX", "MENU_ITEX",
+        "VERSIONS", "", "UNREGISTER_PAT",
+    };
+    TnpMessage message;
+    TnpMessageType type;
+    gchar* line;
+    guint i;
+
+    for(type = TNP_MESSAGE_UNKNOWN + 1; type < TNP_MESSAGE_N_TYPES; type++)
+    {
+        line = g_strdup_printf("%s:a:b:c", tnp_message_type_name(type));
+        g_assert_true(tnp_message_parse(line, &message));
+        g_assert_cmpint(message.type, ==, type);
+        g_free(line);
+    }
+    for(i = 0; i < G_N_ELEMENTS(unknown); i++)
+    {
+        line = g_strdup_printf("%s:a:b:c", unknown[i]);
+        g_assert_false(tnp_message_parse(line, &message));
+        g_free(line);
+    }
+}
+
+static void test_path_index_lookup()
+{
+    TnpPathIndex* index = tnp_path_index_new();
+
+    g_assert_true(tnp_path_index_insert(index, "/home/u/Nextcloud", 1));
+    g_assert_true(tnp_path_index_insert(index, "/home/u/Nextcloud/inner", 1));
+    g_assert_false(tnp_path_index_insert(index, "relative", 1));
+    g_assert_cmpuint(tnp_path_index_size(index), ==, 2);
+
+    g_assert_cmpstr(tnp_path_index_lookup(index, "/home/u/Nextcloud"), ==, "/home/u/Nextcloud");
+    g_assert_cmpstr(tnp_path_index_lookup(index, "/home/u/Nextcloud/a/b"), ==, "/home/u/Nextcloud");
+    // the innermost root wins
+    g_assert_cmpstr(tnp_path_index_lookup(index, "/home/u/Nextcloud/inner/a"), ==, "/home/u/Nextcloud/inner");
+    // only whole components match
+    g_assert_null(tnp_path_index_lookup(index, "/home/u/Nextcloud2/a"));
+    g_assert_cmpstr(tnp_path_index_lookup(index, "/home/u/Nextcloud/inner2"), ==, "/home/u/Nextcloud");
+    g_assert_null(tnp_path_index_lookup(index, "/home/u"));
+    g_assert_null(tnp_path_index_lookup(index, "/"));
+
+    g_assert_true(tnp_path_index_remove(index, "/home/u/Nextcloud/inner", 1));
+    g_assert_cmpstr(tnp_path_index_lookup(index, "/home/u/Nextcloud/inner/a"), ==, "/home/u/Nextcloud");
+    tnp_path_index_clear(index);
+    g_assert_cmpuint(tnp_path_index_size(index), ==, 0);
+    g_assert_null(tnp_path_index_lookup(index, "/home/u/Nextcloud/a"));
+
+    tnp_path_index_free(index);
+}
+
+static void test_path_index_owners()
+{
+    TnpPathIndex* index = tnp_path_index_new();
+    TnpPathIndex* copy;
+    guint owner = 0;
+
+    // the first owner keeps a root registered twice
+    g_assert_true(tnp_path_index_insert(index, "/a/b", 1));
+    g_assert_false(tnp_path_index_insert(index, "/a/b", 2));
+    g_assert_cmpstr(tnp_path_index_lookup_owner(index, "/a/b/c", &owner), ==, "/a/b");
+    g_assert_cmpuint(owner, ==, 1);
+
+    // only owners can remove it, and the other one takes over
+    g_assert_false(tnp_path_index_remove(index, "/a/b", 3));
+    g_assert_true(tnp_path_index_remove(index, "/a/b", 1));
+    g_assert_cmpstr(tnp_path_index_lookup_owner(index, "/a/b/c", &owner), ==, "/a/b");
+    g_assert_cmpuint(owner, ==, 2);
+    g_assert_cmpuint(tnp_path_index_size(index), ==, 1);
+
+    g_assert_true(tnp_path_index_insert(index, "/z", 2));
+    g_assert_true(tnp_path_index_insert(index, "/y", 3));
+    copy = tnp_path_index_copy(index);
+    g_assert_cmpuint(tnp_path_index_remove_owner(index, 2), ==, 2);
+    g_assert_cmpuint(tnp_path_index_size(index), ==, 1);
+    g_assert_null(tnp_path_index_lookup(index, "/a/b/c"));
+    g_assert_nonnull(tnp_path_index_lookup_owner(index, "/y", &owner));
+    g_assert_cmpuint(owner, ==, 3);
+    // copies are independent
+    g_assert_nonnull(tnp_path_index_lookup_owner(copy, "/a/b/c", &owner));
+    g_assert_cmpuint(owner, ==, 2);
+    g_assert_cmpuint(tnp_path_index_size(copy), ==, 3);
+
+    tnp_path_index_free(copy);
+    tnp_path_index_free(index);
+}
+
+static void test_path_index_generation()
+{
+    TnpPathIndex* index = tnp_path_index_new();
+    TnpPathIndex* copy;
+    guint generation = tnp_path_index_generation(index);
+
+    g_assert_true(tnp_path_index_insert(index, "/a", 1));
+    g_assert_cmpuint(tnp_path_index_generation(index), !=, generation);
+    generation = tnp_path_index_generation(index);
+
+    // changes nobody can observe keep the generation
+    g_assert_false(tnp_path_index_insert(index, "/a", 1));
+    g_assert_false(tnp_path_index_insert(index, "/a", 2));
+    g_assert_false(tnp_path_index_remove(index, "/b", 1));
+    g_assert_cmpuint(tnp_path_index_remove_owner(index, 3), ==, 0);
+    g_assert_cmpuint(tnp_path_index_generation(index), ==, generation);
+
+    // handing a root over does not
+    g_assert_true(tnp_path_index_remove(index, "/a", 1));
+    g_assert_cmpuint(tnp_path_index_generation(index), !=, generation);
+
+    // generations are unique across indexes
+    copy = tnp_path_index_copy(index);
+    g_assert_cmpuint(tnp_path_index_generation(copy), !=, tnp_path_index_generation(index));
+
+    tnp_path_index_free(copy);
+    tnp_path_index_free(index);
+}
+
+static void test_path_arena_refs()
+{
+    TnpPathArena* arena = tnp_path_arena_new();
+    TnpPathHandle handle, other;
+
+    handle = tnp_path_arena_intern(arena, "/a/b");
+    g_assert_cmpuint(handle, !=, TNP_PATH_HANDLE_NONE);
+    g_assert_cmpuint(tnp_path_arena_intern(arena, "/a/b"), ==, handle);
+    g_assert_cmpuint(tnp_path_arena_lookup(arena, "/a/b"), ==, handle);
+    g_assert_cmpuint(tnp_path_arena_size(arena), ==, 1);
+    g_assert_cmpstr(tnp_path_arena_get(arena, handle), ==, "/a/b");
+    other = tnp_path_arena_intern(arena, "/a/c");
+    g_assert_cmpuint(other, !=, handle);
+
+    // the path lives as long as it is referenced
+    tnp_path_arena_unref(arena, handle);
+    g_assert_cmpuint(tnp_path_arena_lookup(arena, "/a/b"), ==, handle);
+    tnp_path_arena_ref(arena, handle);
+    tnp_path_arena_unref(arena, handle);
+    tnp_path_arena_unref(arena, handle);
+    g_assert_cmpuint(tnp_path_arena_lookup(arena, "/a/b"), ==, TNP_PATH_HANDLE_NONE);
+    g_assert_cmpuint(tnp_path_arena_size(arena), ==, 1);
+
+    // released handles are reused
+    g_assert_cmpuint(tnp_path_arena_intern(arena, "/a/d"), ==, handle);
+    g_assert_cmpstr(tnp_path_arena_get(arena, handle), ==, "/a/d");
+    g_assert_cmpstr(tnp_path_arena_get(arena, other), ==, "/a/c");
+
+    tnp_path_arena_free(arena);
+}
+
+static void test_path_arena_compaction()
+{
+    TnpPathArena* arena = tnp_path_arena_new();
+    TnpPathHandle handles[4000];
+    const gchar* before[G_N_ELEMENTS(handles)];
+    gchar* oversize = g_strnfill(20000, 'x');
+    TnpPathHandle oversize_handle, handle;
+    gchar path[64];
+    guint i;
+
+    oversize[0] = '/';
+    oversize_handle = tnp_path_arena_intern(arena, oversize);
+    for(i = 0; i < G_N_ELEMENTS(handles); i++)
+    {
+        g_snprintf(path, sizeof(path), "/home/u/Nextcloud/file-%05u", i);
+        handles[i] = tnp_path_arena_intern(arena, path);
+        before[i] = tnp_path_arena_get(arena, handles[i]);
+    }
+    // release all but every 100th path, which leaves mostly dead space
+    for(i = 0; i < G_N_ELEMENTS(handles); i++)
+    {
+        if(i % 100 != 0)
+        {
+            tnp_path_arena_unref(arena, handles[i]);
+        }
+    }
+    // strings stay valid until the main loop runs
+    g_assert_cmpstr(tnp_path_arena_get(arena, handles[100]), ==, "/home/u/Nextcloud/file-00100");
+    run_idle();
+
+    // the live paths moved, keeping their handles
+    g_assert_cmpuint(tnp_path_arena_size(arena), ==, G_N_ELEMENTS(handles) / 100 + 1);
+    g_assert_true(tnp_path_arena_get(arena, handles[100]) != before[100]);
+    for(i = 0; i < G_N_ELEMENTS(handles); i += 100)
+    {
+        g_snprintf(path, sizeof(path), "/home/u/Nextcloud/file-%05u", i);
+        g_assert_cmpstr(tnp_path_arena_get(arena, handles[i]), ==, path);
+        g_assert_cmpuint(tnp_path_arena_lookup(arena, path), ==, handles[i]);
+    }
+    g_assert_cmpstr(tnp_path_arena_get(arena, oversize_handle), ==, oversize);
+    g_assert_cmpuint(tnp_path_arena_lookup(arena, oversize), ==, oversize_handle);
+
+    // the arena keeps working afterwards
+    g_assert_cmpuint(tnp_path_arena_lookup(arena, "/home/u/Nextcloud/file-00001"), ==, TNP_PATH_HANDLE_NONE);
+    handle = tnp_path_arena_intern(arena, "/home/u/Nextcloud/file-00001");
+    g_assert_cmpstr(tnp_path_arena_get(arena, handle), ==, "/home/u/Nextcloud/file-00001");
+
+    g_free(oversize);
+    tnp_path_arena_free(arena);
+}
+
+typedef struct
+{
+    GString* sent;
+    gboolean fail;
+    // "<status>:<path>" of every reported change
+    GString* changes;
+} CacheFixture;
+
+static gboolean status_send(const gchar* data, gsize length, gpointer user_data)
+{
+    CacheFixture* fixture = user_data;
+
+    if(fixture->fail)
+    {
+        return FALSE;
+    }
+    g_string_append_len(fixture->sent, data, length);
+    return TRUE;
+}
+
+static void status_changed(const gchar* path, TnpSyncStatus status, gboolean shared, gpointer user_data)
+{
+    CacheFixture* fixture = user_data;
+
+    g_string_append_printf(fixture->changes, "%d%s:%s\n", status, shared ? "+" : "", path);
+}
+
+static void test_status_cache()
+{
+    CacheFixture fixture = { g_string_new(NULL), FALSE, g_string_new(NULL) };
+    TnpPathArena* arena = tnp_path_arena_new();
+    TnpStatusCache* cache = tnp_status_cache_new(arena, status_send, status_changed, &fixture);
+    gboolean shared;
+
+    // requests are sent once and in one burst
+    tnp_status_cache_request(cache, "/r/a", FALSE);
+    tnp_status_cache_request(cache, "/r/a", FALSE);
+    tnp_status_cache_request(cache, "/r/d", TRUE);
+    g_assert_cmpuint(fixture.sent->len, ==, 0);
+    run_idle();
+    g_assert_cmpstr(fixture.sent->str, ==, "RETRIEVE_FILE_STATUS:/r/a\nRETRIEVE_FOLDER_STATUS:/r/d\n");
+
+    tnp_status_cache_update(cache, "SYNC", "/r/a");
+    tnp_status_cache_update(cache, "OK+SWM", "/r/d/b");
+    g_assert_cmpstr(fixture.changes->str, ==, "2:/r/a\n1+:/r/d/b\n");
+    g_assert_cmpint(tnp_status_cache_get(cache, "/r/a", NULL), ==, TNP_SYNC_STATUS_SYNC);
+    g_assert_cmpint(tnp_status_cache_get(cache, "/r/d/b", &shared), ==, TNP_SYNC_STATUS_OK);
+    g_assert_true(shared);
+    g_assert_cmpint(tnp_status_cache_get(cache, "/r/d", NULL), ==, TNP_SYNC_STATUS_UNKNOWN);
+    // the same status is not reported again
+    tnp_status_cache_update(cache, "SYNC", "/r/a");
+    g_assert_cmpstr(fixture.changes->str, ==, "2:/r/a\n1+:/r/d/b\n");
+
+    // summaries of the subtree
+    g_assert_cmpint(tnp_status_cache_get_recursive(cache, "/r"), ==, TNP_SYNC_STATUS_SYNC);
+    g_assert_cmpint(tnp_status_cache_get_recursive(cache, "/r/d"), ==, TNP_SYNC_STATUS_OK);
+    g_assert_cmpuint(tnp_status_cache_count(cache, "/r", TNP_SYNC_STATUS_OK), ==, 1);
+    tnp_status_cache_update(cache, "ERROR", "/r/d/b");
+    g_assert_cmpint(tnp_status_cache_get_recursive(cache, "/r"), ==, TNP_SYNC_STATUS_ERROR);
+    g_assert_cmpuint(tnp_status_cache_count(cache, "/r", TNP_SYNC_STATUS_OK), ==, 0);
+
+    // known statuses are not requested again
+    g_string_truncate(fixture.sent, 0);
+    tnp_status_cache_request(cache, "/r/a", FALSE);
+    run_idle();
+    g_assert_cmpuint(fixture.sent->len, ==, 0);
+
+    // forgotten statuses are reported as unknown
+    g_string_truncate(fixture.changes, 0);
+    tnp_status_cache_invalidate(cache, "/r/d");
+    g_assert_cmpstr(fixture.changes->str, ==, "0:/r/d/b\n");
+    g_assert_cmpint(tnp_status_cache_get_recursive(cache, "/r"), ==, TNP_SYNC_STATUS_SYNC);
+
+    // requests that could not be sent may be repeated
+    fixture.fail = TRUE;
+    tnp_status_cache_request(cache, "/r/e", FALSE);
+    run_idle();
+    fixture.fail = FALSE;
+    tnp_status_cache_request(cache, "/r/e", FALSE);
+    run_idle();
+    g_assert_cmpstr(fixture.sent->str, ==, "RETRIEVE_FILE_STATUS:/r/e\n");
+
+    tnp_status_cache_clear(cache);
+    g_assert_cmpint(tnp_status_cache_get_recursive(cache, "/r"), ==, TNP_SYNC_STATUS_UNKNOWN);
+    tnp_status_cache_free(cache);
+    // the cache released all its paths
+    g_assert_cmpuint(tnp_path_arena_size(arena), ==, 0);
+    tnp_path_arena_free(arena);
+    g_string_free(fixture.sent, TRUE);
+    g_string_free(fixture.changes, TRUE);
+}
+
+static gboolean menu_send(guint connection, const gchar* data, gsize length, gpointer user_data)
+{
+    CacheFixture* fixture = user_data;
+
+    g_string_append_printf(fixture->sent, "%u>", connection);
+    g_string_append_len(fixture->sent, data, length);
+    return TRUE;
+}
+
+/**
+ * Hands "line" to the menu cache as if received on "connection".
+ */
+static void menu_receive(TnpMenuCache* cache, guint connection, const gchar* line)
+{
+    TnpMessage message;
+    gchar* copy = g_strdup(line);
+
+    g_assert_true(tnp_message_parse(copy, &message));
+    tnp_menu_cache_handle_message(cache, connection, &message);
+    g_free(copy);
+}
+
+static void test_menu_cache()
+{
+    CacheFixture fixture = { g_string_new(NULL), FALSE, NULL };
+    TnpMenuCache* cache = tnp_menu_cache_new(menu_send, &fixture);
+    GPtrArray* paths = g_ptr_array_new();
+    const GPtrArray* actions;
+    guint generation = tnp_menu_cache_get_generation(cache);
+    guint i;
+
+    // misses are fetched once per root, from the client owning it
+    g_ptr_array_add(paths, "/r1/a");
+    g_ptr_array_add(paths, "/r1/b");
+    for(i = 0; i < 10; i++)
+    {
+        g_assert_null(tnp_menu_cache_lookup(cache, "/r1", 1, TNP_MENU_KIND_MULTIPLE, paths));
+    }
+    g_ptr_array_set_size(paths, 1);
+    g_assert_null(tnp_menu_cache_lookup(cache, "/r2", 2, TNP_MENU_KIND_FILE, paths));
+    g_assert_cmpuint(fixture.sent->len, ==, 0);
+    run_idle();
+    // one write per connection, in no particular order
+    g_assert_nonnull(strstr(fixture.sent->str, "1>GET_MENU_ITEMS:/r1/a" TNP_MENU_PATH_SEPARATOR "/r1/b\n"));
+    g_assert_nonnull(strstr(fixture.sent->str, "2>GET_MENU_ITEMS:/r1/a\n"));
+    g_assert_cmpuint(fixture.sent->len, ==, strlen("1>GET_MENU_ITEMS:/r1/a" TNP_MENU_PATH_SEPARATOR "/r1/b\n"
+                                                   "2>GET_MENU_ITEMS:/r1/a\n"));
+    g_assert_cmpuint(tnp_menu_cache_get_generation(cache), ==, generation);
+
+    // replies are matched per connection, whichever arrives first
+    menu_receive(cache, 2, "GET_MENU_ITEMS:BEGIN");
+    menu_receive(cache, 1, "GET_MENU_ITEMS:BEGIN");
+    menu_receive(cache, 2, "MENU_ITEM:SHARE::Share two");
+    menu_receive(cache, 2, "GET_MENU_ITEMS:END");
+    g_assert_cmpuint(tnp_menu_cache_get_generation(cache), !=, generation);
+    actions = tnp_menu_cache_lookup(cache, "/r2", 2, TNP_MENU_KIND_FILE, paths);
+    g_assert_nonnull(actions);
+    g_assert_cmpuint(actions->len, ==, 1);
+    g_assert_cmpstr(((TnpMenuAction*) g_ptr_array_index(actions, 0))->text, ==, "Share two");
+    g_assert_null(tnp_menu_cache_lookup(cache, "/r1", 1, TNP_MENU_KIND_MULTIPLE, paths));
+    menu_receive(cache, 1, "MENU_ITEM:SHARE:d:Share one");
+    menu_receive(cache, 1, "MENU_ITEM:COPY_PRIVATE_LINK::Copy");
+    menu_receive(cache, 1, "GET_MENU_ITEMS:END");
+    actions = tnp_menu_cache_lookup(cache, "/r1", 1, TNP_MENU_KIND_MULTIPLE, paths);
+    g_assert_nonnull(actions);
+    g_assert_cmpuint(actions->len, ==, 2);
+    g_assert_cmpstr(((TnpMenuAction*) g_ptr_array_index(actions, 0))->flags, ==, "d");
+    // the kinds of selection have their own menus
+    g_assert_null(tnp_menu_cache_lookup(cache, "/r1", 1, TNP_MENU_KIND_FILE, paths));
+
+    run_idle();
+
+    // refreshing keeps the old menu until the new one arrives
+    g_string_truncate(fixture.sent, 0);
+    tnp_menu_cache_invalidate(cache, "/r2/x");
+    run_idle();
+    g_assert_cmpstr(fixture.sent->str, ==, "2>GET_MENU_ITEMS:/r1/a\n");
+    g_assert_nonnull(tnp_menu_cache_lookup(cache, "/r2", 2, TNP_MENU_KIND_FILE, paths));
+
+    // a lost connection takes its menus and requests along, stray replies
+    // are ignored
+    tnp_menu_cache_disconnect(cache, 2);
+    menu_receive(cache, 2, "GET_MENU_ITEMS:BEGIN");
+    menu_receive(cache, 2, "GET_MENU_ITEMS:END");
+    g_assert_null(tnp_menu_cache_lookup(cache, "/r2", 3, TNP_MENU_KIND_FILE, paths));
+    g_assert_nonnull(tnp_menu_cache_lookup(cache, "/r1", 1, TNP_MENU_KIND_MULTIPLE, paths));
+    g_string_truncate(fixture.sent, 0);
+    run_idle();
+    g_assert_true(g_str_has_prefix(fixture.sent->str, "3>GET_MENU_ITEMS:"));
+
+    tnp_menu_cache_clear(cache);
+    g_assert_null(tnp_menu_cache_lookup(cache, "/r1", 1, TNP_MENU_KIND_MULTIPLE, paths));
+    tnp_menu_cache_free(cache);
+    g_ptr_array_free(paths, TRUE);
+    g_string_free(fixture.sent, TRUE);
+}
+
+static void test_menu_cache_out_of_order()
+{
+    CacheFixture fixture = { g_string_new(NULL), FALSE, NULL };
+    TnpMenuCache* cache = tnp_menu_cache_new(menu_send, &fixture);
+    GPtrArray* paths = g_ptr_array_new();
+    const GPtrArray* actions;
+    guint generation;
+
+    // wait 10 ms for a menu, and not beyond 50 ms
+    tnp_menu_cache_set_timeouts(cache, 10000, 10000, 50000);
+    g_ptr_array_add(paths, "/r1/a");
+    g_assert_null(tnp_menu_cache_lookup(cache, "/r1", 1, TNP_MENU_KIND_FILE, paths));
+    run_idle();
+    g_usleep(60000);
+    run_idle();
+
+    // the next request finds the first one unanswered for too long
+    g_ptr_array_index(paths, 0) = "/r2/a";
+    g_assert_null(tnp_menu_cache_lookup(cache, "/r2", 1, TNP_MENU_KIND_FILE, paths));
+    generation = tnp_menu_cache_get_generation(cache);
+    // so the reply to the first one is not taken for the second one's
+    menu_receive(cache, 1, "GET_MENU_ITEMS:BEGIN");
+    menu_receive(cache, 1, "MENU_ITEM:SHARE::Share one");
+    menu_receive(cache, 1, "GET_MENU_ITEMS:END");
+    g_assert_cmpuint(tnp_menu_cache_get_generation(cache), ==, generation);
+    g_assert_null(tnp_menu_cache_lookup(cache, "/r2", 1, TNP_MENU_KIND_FILE, paths));
+
+    // replies count again once the new request was written
+    g_string_truncate(fixture.sent, 0);
+    run_idle();
+    g_assert_cmpstr(fixture.sent->str, ==, "1>GET_MENU_ITEMS:/r2/a\n");
+    menu_receive(cache, 1, "GET_MENU_ITEMS:BEGIN");
+    menu_receive(cache, 1, "MENU_ITEM:SHARE::Share two");
+    menu_receive(cache, 1, "GET_MENU_ITEMS:END");
+    actions = tnp_menu_cache_lookup(cache, "/r2", 1, TNP_MENU_KIND_FILE, paths);
+    g_assert_nonnull(actions);
+    g_assert_cmpstr(((TnpMenuAction*) g_ptr_array_index(actions, 0))->text, ==, "Share two");
+
+    // the dropped menu is requested again
+    g_ptr_array_index(paths, 0) = "/r1/a";
+    g_assert_null(tnp_menu_cache_lookup(cache, "/r1", 1, TNP_MENU_KIND_FILE, paths));
+    g_string_truncate(fixture.sent, 0);
+    run_idle();
+    g_assert_cmpstr(fixture.sent->str, ==, "1>GET_MENU_ITEMS:/r1/a\n");
+
+    tnp_menu_cache_free(cache);
+    g_ptr_array_free(paths, TRUE);
+    g_string_free(fixture.sent, TRUE);
+}
+
+int main(int argc, char** argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/framer/partial-lines", test_framer_partial_lines);
+    g_test_add_func("/framer/oversize", test_framer_oversize);
+    g_test_add_func("/framer/growth", test_framer_growth);
+    g_test_add_func("/framer/flood", test_framer_flood);
+    g_test_add_func("/protocol/parse", test_protocol_parse);
+    g_test_add_func("/protocol/lookup-command", test_protocol_lookup_command);
+    g_test_add_func("/path-index/lookup", test_path_index_lookup);
+    g_test_add_func("/path-index/owners", test_path_index_owners);
+    g_test_add_func("/path-index/generation", test_path_index_generation);
+    g_test_add_func("/path-arena/refs", test_path_arena_refs);
+    g_test_add_func("/path-arena/compaction", test_path_arena_compaction);
+    g_test_add_func("/status-cache", test_status_cache);
+    g_test_add_func("/menu-cache", test_menu_cache);
+    g_test_add_func("/menu-cache/out-of-order", test_menu_cache_out_of_order);
+    return g_test_run();
+}
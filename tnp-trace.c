@@ -0,0 +1,276 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tnp-stats.h"
+#include "tnp-trace.h"
+
+// environment variable enabling the capture
+#define TRACE_ENV "TNP_TRACE"
+#define TRACE_MAGIC "TNPTRACE"
+// increment whenever the layout changes
+#define TRACE_VERSION 1
+// a record header: type, connection, time delta and length
+#define RECORD_HEADER_MAX_SIZE (1 + 5 + 10 + 10)
+
+/**
+ * The file starts with this header, followed by the records. Each record is
+ * its type as a single byte, then its connection, the nanoseconds since the
+ * previous record and the length of its data as unsigned LEB128 numbers, then
+ * the data. Numbers in the header are in host byte order, like the trace is
+ * replayed on the machine it was recorded on.
+ */
+typedef struct
+{
+    gchar   magic[8];
+    guint32 version;
+} TnpTraceHeader;
+
+struct _TnpTraceReader
+{
+    GMappedFile* file;
+    const gchar* data;
+    gsize        length;
+    gsize        offset;
+    gint64       time;
+    gboolean     truncated;
+};
+
+gboolean tnp_trace_enabled = FALSE;
+
+static GMutex trace_lock;
+static FILE* trace_file = NULL;
+static gint64 last_time = 0;
+
+/**
+ * Starts the capture if requested through the environment. Must be called
+ * from the main context before any other thread uses the probes.
+ */
+void tnp_trace_init()
+{
+    const gchar* value = g_getenv(TRACE_ENV);
+    TnpTraceHeader header;
+    gchar* filename;
+
+    if(tnp_trace_enabled || value == NULL || value[0] == '\0' || strcmp(value, "0") == 0)
+    {
+        return;
+    }
+    if(strcmp(value, "1") == 0)
+    {
+        filename = g_strdup_printf("%s/thunar-nextcloud-plugin.%d.trace", g_get_user_runtime_dir(), getpid());
+    }
+    else
+    {
+        filename = g_strdup(value);
+    }
+    trace_file = fopen(filename, "wb");
+    if(trace_file == NULL)
+    {
+        g_warning("Failed to open the trace '%s'", filename);
+        g_free(filename);
+        return;
+    }
+    g_free(filename);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    fwrite(&header, sizeof(header), 1, trace_file);
+    last_time = tnp_stats_now();
+    tnp_trace_enabled = TRUE;
+}
+
+/**
+ * Writes the remaining records and stops the capture.
+ */
+void tnp_trace_shutdown()
+{
+    if(!tnp_trace_enabled)
+    {
+        return;
+    }
+    g_mutex_lock(&trace_lock);
+    tnp_trace_enabled = FALSE;
+    fclose(trace_file);
+    trace_file = NULL;
+    g_mutex_unlock(&trace_lock);
+}
+
+static guint put_number(guchar* buffer, guint64 value)
+{
+    guint n = 0;
+
+    while(value >= 0x80)
+    {
+        buffer[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buffer[n++] = value;
+    return n;
+}
+
+void tnp_trace_record_real(TnpTraceType type, guint connection, const gchar* data, gsize length)
+{
+    guchar header[RECORD_HEADER_MAX_SIZE];
+    guint n = 0;
+    gint64 now;
+
+    g_mutex_lock(&trace_lock);
+    // the capture may just have been stopped
+    if(trace_file != NULL)
+    {
+        now = tnp_stats_now();
+        header[n++] = type;
+        n += put_number(header + n, connection);
+        n += put_number(header + n, MAX(now - last_time, 0));
+        n += put_number(header + n, length);
+        last_time = now;
+        fwrite(header, 1, n, trace_file);
+        if(length > 0)
+        {
+            fwrite(data, 1, length, trace_file);
+        }
+    }
+    g_mutex_unlock(&trace_lock);
+}
+
+void tnp_trace_flush_real()
+{
+    g_mutex_lock(&trace_lock);
+    if(trace_file != NULL)
+    {
+        fflush(trace_file);
+    }
+    g_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Opens the trace "filename" for reading.
+ * @return The reader or NULL if the file is no trace of this version
+ */
+TnpTraceReader* tnp_trace_reader_new(const gchar* filename)
+{
+    GMappedFile* file;
+    TnpTraceHeader header;
+    TnpTraceReader* reader;
+
+    file = g_mapped_file_new(filename, FALSE, NULL);
+    if(file == NULL)
+    {
+        return NULL;
+    }
+    if(g_mapped_file_get_length(file) < sizeof(header))
+    {
+        g_mapped_file_unref(file);
+        return NULL;
+    }
+    // the mapping need not be aligned for the header
+    memcpy(&header, g_mapped_file_get_contents(file), sizeof(header));
+    if(memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION)
+    {
+        g_mapped_file_unref(file);
+        return NULL;
+    }
+    reader = g_slice_new0(TnpTraceReader);
+    reader->file = file;
+    reader->data = g_mapped_file_get_contents(file);
+    reader->length = g_mapped_file_get_length(file);
+    tnp_trace_reader_rewind(reader);
+    return reader;
+}
+
+void tnp_trace_reader_free(TnpTraceReader* reader)
+{
+    g_mapped_file_unref(reader->file);
+    g_slice_free(TnpTraceReader, reader);
+}
+
+/**
+ * Starts over with the first record.
+ */
+void tnp_trace_reader_rewind(TnpTraceReader* reader)
+{
+    reader->offset = sizeof(TnpTraceHeader);
+    reader->time = 0;
+    reader->truncated = FALSE;
+}
+
+static gboolean get_number(TnpTraceReader* reader, guint64* value)
+{
+    guint shift = 0;
+    guchar byte;
+
+    *value = 0;
+    do
+    {
+        if(reader->offset >= reader->length || shift > 63)
+        {
+            return FALSE;
+        }
+        byte = reader->data[reader->offset++];
+        *value |= (guint64) (byte & 0x7f) << shift;
+        shift += 7;
+    }
+    while(byte & 0x80);
+    return TRUE;
+}
+
+/**
+ * Reads the next record into "record".
+ * @return FALSE at the end of the trace or if the rest of it is damaged, e.g.
+ *         because the process was killed while writing it
+ */
+gboolean tnp_trace_reader_next(TnpTraceReader* reader, TnpTraceRecord* record)
+{
+    guint64 connection, delta, length;
+    gsize start = reader->offset;
+
+    if(reader->offset >= reader->length || reader->truncated)
+    {
+        return FALSE;
+    }
+    record->type = (guchar) reader->data[reader->offset++];
+    if(record->type >= TNP_TRACE_N_TYPES || !get_number(reader, &connection) ||
+       !get_number(reader, &delta) || !get_number(reader, &length) ||
+       length > reader->length - reader->offset || connection > G_MAXUINT)
+    {
+        reader->offset = start;
+        reader->truncated = TRUE;
+        return FALSE;
+    }
+    reader->time += delta;
+    record->connection = connection;
+    record->time = reader->time;
+    record->data = reader->data + reader->offset;
+    record->length = length;
+    reader->offset += length;
+    return TRUE;
+}
+
+/**
+ * Returns whether reading stopped before the end of the trace.
+ */
+gboolean tnp_trace_reader_is_truncated(const TnpTraceReader* reader)
+{
+    return reader->truncated;
+}
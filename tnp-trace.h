@@ -0,0 +1,90 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_TRACE_H__
+#define __TNP_TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS;
+
+/**
+ * Capture of the bytes exchanged with the client sockets, for replaying real
+ * traffic offline with tnp-replay. Recording is enabled through the
+ * environment variable TNP_TRACE, which names the trace file; "1" writes it to
+ * $XDG_RUNTIME_DIR/thunar-nextcloud-plugin.<pid>.trace. When disabled, each
+ * probe costs a single predictable branch.
+ *
+ * Thread-safety: probes may be used from any thread.
+ */
+typedef enum
+{
+    // the socket path of a new connection
+    TNP_TRACE_CONNECTED,
+    TNP_TRACE_DISCONNECTED,
+    // bytes as returned by recv()
+    TNP_TRACE_RECEIVED,
+    // bytes as accepted by send()
+    TNP_TRACE_SENT,
+    TNP_TRACE_N_TYPES,
+} TnpTraceType;
+
+typedef struct
+{
+    TnpTraceType type;
+    guint        connection;
+    // nanoseconds since the start of the trace
+    gint64       time;
+    // points into the trace, valid as long as the reader
+    const gchar* data;
+    gsize        length;
+} TnpTraceRecord;
+
+typedef struct _TnpTraceReader TnpTraceReader;
+
+// read by the probes below, set once by tnp_trace_init()
+extern gboolean tnp_trace_enabled G_GNUC_INTERNAL;
+
+void tnp_trace_init (void) G_GNUC_INTERNAL;
+void tnp_trace_shutdown (void) G_GNUC_INTERNAL;
+void tnp_trace_record_real (TnpTraceType type, guint connection, const gchar* data, gsize length) G_GNUC_INTERNAL;
+void tnp_trace_flush_real (void) G_GNUC_INTERNAL;
+
+TnpTraceReader* tnp_trace_reader_new (const gchar* filename) G_GNUC_INTERNAL;
+void tnp_trace_reader_free (TnpTraceReader* reader) G_GNUC_INTERNAL;
+void tnp_trace_reader_rewind (TnpTraceReader* reader) G_GNUC_INTERNAL;
+gboolean tnp_trace_reader_next (TnpTraceReader* reader, TnpTraceRecord* record) G_GNUC_INTERNAL;
+gboolean tnp_trace_reader_is_truncated (const TnpTraceReader* reader) G_GNUC_INTERNAL;
+
+/**
+ * Appends "length" bytes of "data" exchanged on "connection" to the trace.
+ */
+#define tnp_trace_record(type, connection, data, length) \
+    G_STMT_START { if(G_UNLIKELY(tnp_trace_enabled)) tnp_trace_record_real((type), (connection), (data), (length)); } G_STMT_END
+
+/**
+ * Writes the buffered records, so that a crash loses as little as possible.
+ */
+#define tnp_trace_flush() \
+    G_STMT_START { if(G_UNLIKELY(tnp_trace_enabled)) tnp_trace_flush_real(); } G_STMT_END
+
+G_END_DECLS;
+
+#endif /* !__TNP_TRACE_H__ */
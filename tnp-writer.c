@@ -0,0 +1,204 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "tnp-stats.h"
+#include "tnp-trace.h"
+#include "tnp-writer.h"
+
+// segments written per sendmsg(), well below IOV_MAX
+#define WRITER_MAX_IOV 64
+
+typedef struct
+{
+    GBytes* bytes;
+    gsize   offset;
+    gsize   length;
+} TnpWriterSegment;
+
+struct _TnpWriter
+{
+    // TnpWriterSegment, oldest first
+    GQueue  segments;
+    // bytes of the first segment that were already written
+    gsize   head_written;
+    gsize   pending;
+    guint   trace_connection;
+};
+
+/**
+ * Creates an empty writer. "trace_connection" identifies the written data in
+ * the trace, see tnp-trace.h.
+ */
+TnpWriter* tnp_writer_new(guint trace_connection)
+{
+    TnpWriter* writer = g_slice_new0(TnpWriter);
+    g_queue_init(&writer->segments);
+    writer->trace_connection = trace_connection;
+    return writer;
+}
+
+void tnp_writer_free(TnpWriter* writer)
+{
+    if(writer == NULL)
+    {
+        return;
+    }
+    tnp_writer_reset(writer);
+    g_slice_free(TnpWriter, writer);
+}
+
+static void tnp_writer_segment_free(TnpWriterSegment* segment)
+{
+    g_bytes_unref(segment->bytes);
+    g_slice_free(TnpWriterSegment, segment);
+}
+
+/**
+ * Drops all queued data, e.g. when the connection is lost.
+ */
+void tnp_writer_reset(TnpWriter* writer)
+{
+    TnpWriterSegment* segment;
+
+    while((segment = g_queue_pop_head(&writer->segments)) != NULL)
+    {
+        tnp_writer_segment_free(segment);
+    }
+    writer->head_written = 0;
+    writer->pending = 0;
+}
+
+/**
+ * Queues "length" bytes of "bytes" starting at "offset", which must consist of
+ * complete commands. A slice that continues the previous one in the same
+ * buffer extends it, so a burst routed line by line is still written as one
+ * segment.
+ */
+void tnp_writer_push(TnpWriter* writer, GBytes* bytes, gsize offset, gsize length)
+{
+    TnpWriterSegment* segment = g_queue_peek_tail(&writer->segments);
+
+    if(length == 0)
+    {
+        return;
+    }
+    writer->pending += length;
+    if(segment != NULL && segment->bytes == bytes && segment->offset + segment->length == offset)
+    {
+        segment->length += length;
+        return;
+    }
+    segment = g_slice_new(TnpWriterSegment);
+    segment->bytes = g_bytes_ref(bytes);
+    segment->offset = offset;
+    segment->length = length;
+    g_queue_push_tail(&writer->segments, segment);
+}
+
+/**
+ * Returns the number of bytes waiting to be written.
+ */
+gsize tnp_writer_get_pending(const TnpWriter* writer)
+{
+    return writer->pending;
+}
+
+/**
+ * Drops the first "written" bytes of the queue.
+ */
+static void tnp_writer_consume(TnpWriter* writer, gsize written)
+{
+    TnpWriterSegment* segment;
+    const gchar* data;
+    gsize length;
+
+    writer->pending -= written;
+    while(written > 0)
+    {
+        segment = g_queue_peek_head(&writer->segments);
+        data = (const gchar*) g_bytes_get_data(segment->bytes, NULL) + segment->offset + writer->head_written;
+        length = MIN(segment->length - writer->head_written, written);
+        tnp_trace_record(TNP_TRACE_SENT, writer->trace_connection, data, length);
+        written -= length;
+        writer->head_written += length;
+        if(writer->head_written == segment->length)
+        {
+            tnp_writer_segment_free(g_queue_pop_head(&writer->segments));
+            writer->head_written = 0;
+        }
+    }
+}
+
+/**
+ * Writes as much of the queue to "fd" as it accepts without blocking. Uses
+ * MSG_NOSIGNAL, so a closed connection fails instead of raising SIGPIPE.
+ */
+TnpWriterResult tnp_writer_flush(TnpWriter* writer, int fd)
+{
+    struct iovec iov[WRITER_MAX_IOV];
+    struct msghdr message;
+    TnpWriterSegment* segment;
+    GList* link;
+    gsize skip;
+    ssize_t ret;
+    int n;
+
+    while(writer->pending > 0)
+    {
+        n = 0;
+        skip = writer->head_written;
+        for(link = writer->segments.head; link != NULL && n < WRITER_MAX_IOV; link = link->next)
+        {
+            segment = link->data;
+            iov[n].iov_base = (gchar*) g_bytes_get_data(segment->bytes, NULL) + segment->offset + skip;
+            iov[n].iov_len = segment->length - skip;
+            skip = 0;
+            n++;
+        }
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = iov;
+        message.msg_iovlen = n;
+        ret = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if(ret > 0)
+        {
+            tnp_stats_add(TNP_STATS_WRITES, 1);
+            tnp_stats_add(TNP_STATS_BYTES_SENT, ret);
+            tnp_writer_consume(writer, ret);
+        }
+        else if(ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return TNP_WRITER_BLOCKED;
+        }
+        else
+        {
+            return TNP_WRITER_FAILED;
+        }
+    }
+    return TNP_WRITER_FLUSHED;
+}
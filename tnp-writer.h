@@ -0,0 +1,56 @@
+/* vi:set et ai sw=4 sts=4 ts=4: */
+/*-
+ * Copyright (c) 2017 Frederik Möllers <frederik@die-sinlosen.de>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TNP_WRITER_H__
+#define __TNP_WRITER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS;
+
+/**
+ * Queue of the commands waiting to be written to the client socket. Commands
+ * are queued as slices of the buffers they were built in, without copying,
+ * and written with a single sendmsg() per flush. A partial write is resumed
+ * where it stopped once the socket is writable again, so a command is never
+ * cut off or sent twice.
+ */
+typedef struct _TnpWriter TnpWriter;
+
+typedef enum
+{
+    // everything was written
+    TNP_WRITER_FLUSHED,
+    // the socket buffer is full, flush again when the socket is writable
+    TNP_WRITER_BLOCKED,
+    // the connection is broken, see errno
+    TNP_WRITER_FAILED,
+} TnpWriterResult;
+
+TnpWriter* tnp_writer_new (guint trace_connection) G_GNUC_INTERNAL;
+void tnp_writer_free (TnpWriter* writer) G_GNUC_INTERNAL;
+void tnp_writer_reset (TnpWriter* writer) G_GNUC_INTERNAL;
+void tnp_writer_push (TnpWriter* writer, GBytes* bytes, gsize offset, gsize length) G_GNUC_INTERNAL;
+gsize tnp_writer_get_pending (const TnpWriter* writer) G_GNUC_INTERNAL;
+TnpWriterResult tnp_writer_flush (TnpWriter* writer, int fd) G_GNUC_INTERNAL;
+
+G_END_DECLS;
+
+#endif /* !__TNP_WRITER_H__ */